@@ -0,0 +1,17 @@
+/**
+ *  \file bench.c
+ *  \author Orlando Leombruni
+ *
+ *  \brief Funzioni di supporto comuni ai programmi di benchmark e di verifica.
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ */
+
+#include "bench.h"
+
+double elapsed(struct timespec* t0) {
+	struct timespec t1;
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	return (t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
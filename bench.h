@@ -0,0 +1,22 @@
+/**
+ *  \file bench.h
+ *  \author Orlando Leombruni
+ *
+ *  \brief Funzioni di supporto comuni ai programmi di benchmark e di verifica.
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ */
+
+#ifndef __BENCH__H
+#define __BENCH__H
+
+#include <time.h>
+
+/** Secondi trascorsi da un istante misurato con \c clock_gettime(CLOCK_MONOTONIC, ...)
+ * \param t0 istante iniziale
+ *
+ * \retval s secondi trascorsi da \c t0
+ */
+double elapsed(struct timespec* t0);
+#endif
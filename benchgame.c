@@ -0,0 +1,69 @@
+/**
+ *  \file benchgame.c
+ *  \author Orlando Leombruni
+ *
+ *  \brief Benchmark della macchina a stati della partita (game.h), senza I/O.
+ *
+ *  Uso: <tt>benchgame [-n partite]</tt>
+ *
+ *  Gioca \c n partite complete (semi 0, 1, ..., n-1) con \c gameInit, \c gameTurn, \c gamePlay e
+ *  \c gameIsOver, in cui ogni giocatore gioca la carta di indice minimo della propria mano, e
+ *  stampa le partite al secondo ed il tempo medio di un turno. Controlla inoltre che ogni partita
+ *  duri \c NCARTE/2 turni e che i punti dei due giocatori sommino a 120.
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "game.h"
+#include "bench.h"
+
+/** Punti totali del mazzo */
+#define TOTPOINTS 120
+
+int main(int argc, char* argv[]) {
+	game_t g;
+	struct timespec t0;
+	unsigned long n = 2000000, i, tricks = 0, bad = 0;
+	int opt, p, res, t;
+	double dt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+			case 'n': n = atol(optarg); break;
+			default:
+				fprintf(stderr, "uso: %s [-n partite]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (n == 0) {
+		fprintf(stderr, "parametri non validi\n");
+		return EXIT_FAILURE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++) {
+		gameInit(&g, i);
+		t = 0;
+		while (!gameIsOver(&g)) {
+			p = gameTurn(&g);
+			if ((res = gamePlay(&g, p, (card_t)__builtin_ctzll(g.hand[p]))) == -1) {
+				perror("gamePlay");
+				return EXIT_FAILURE;
+			}
+			t += res;
+		}
+		tricks += t;
+		if (t != NCARTE/2 || gameScore(&g, 0) + gameScore(&g, 1) != TOTPOINTS) bad++;
+	}
+	dt = elapsed(&t0);
+	printf("%lu partite: %.0f partite/s, %.1f ns/turno\n", n, n / dt, dt * 1e9 / tricks);
+	if (bad > 0) {
+		fprintf(stderr, "%lu partite non valide\n", bad);
+		return EXIT_FAILURE;
+	}
+	return 0;
+}
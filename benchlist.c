@@ -0,0 +1,117 @@
+/**
+ *  \file benchlist.c
+ *  \author Orlando Leombruni
+ *
+ *  \brief Benchmark della costruzione della lista degli utenti in attesa su una lobby grande.
+ *
+ *  Uso: <tt>benchlist [-u utenti] [-i ripetizioni]</tt>
+ *
+ *  Registra \c u utenti, tutti in attesa, e costruisce \c i volte la lista della lobby e quella
+ *  degli utenti \c WAITING dell'albero, allocando ogni volta un nuovo buffer (\c getLobbyList,
+ *  \c getUserList, come faceva il server ad ogni login) oppure riusando sempre lo stesso
+ *  (\c getLobbyListBuf, \c getUserListBuf, come fa il buffer per thread del server).
+ *  Stampa il tempo medio di una costruzione e controlla che le liste coincidano.
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "users.h"
+#include "bench.h"
+
+int main(int argc, char* argv[]) {
+	userdb_t db = USERDB_INITIALIZER;
+	user_t* pu = NULL;
+	struct timespec t0;
+	char *list = NULL, *buf = NULL, name[LUSER + 1];
+	size_t size = 0, len = 0;
+	unsigned int nusers = 1000000, iter = 5, i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "u:i:")) != -1) {
+		switch (opt) {
+			case 'u': nusers = atoi(optarg); break;
+			case 'i': iter = atoi(optarg); break;
+			default:
+				fprintf(stderr, "uso: %s [-u utenti] [-i ripetizioni]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (nusers == 0 || iter == 0) {
+		fprintf(stderr, "parametri non validi\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Lobby con tutti gli utenti in attesa */
+	for (i = 0; i < nusers; i++) {
+		if ((pu = (user_t*)malloc(sizeof(user_t))) == NULL) {
+			perror("malloc");
+			return EXIT_FAILURE;
+		}
+		sprintf(name, "u%08u", i);
+		strcpy(pu->name, name);
+		strcpy(pu->passwd, "pw");
+		if (addUserDb(&db, pu) != 0) {
+			perror("addUserDb");
+			return EXIT_FAILURE;
+		}
+		setUserStatusDb(&db, name, WAITING);
+	}
+	printf("%u utenti in attesa, %u ripetizioni\n", nusers, iter);
+
+	/* Lobby: buffer nuovo ad ogni chiamata */
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < iter; i++) {
+		if ((list = getLobbyList(&db)) == NULL) {
+			perror("getLobbyList");
+			return EXIT_FAILURE;
+		}
+		len = strlen(list);
+		free(list);
+	}
+	printf("getLobbyList:    %8.2f ms\n", elapsed(&t0) * 1e3 / iter);
+
+	/* Lobby: buffer riusato */
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < iter; i++) {
+		if (getLobbyListBuf(&db, &buf, &size) != len) {
+			perror("getLobbyListBuf");
+			return EXIT_FAILURE;
+		}
+	}
+	printf("getLobbyListBuf: %8.2f ms\n", elapsed(&t0) * 1e3 / iter);
+
+	/* Albero: buffer nuovo ad ogni chiamata */
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < iter; i++) {
+		if ((list = getUserList(db.root, WAITING)) == NULL || strlen(list) != len) {
+			perror("getUserList");
+			return EXIT_FAILURE;
+		}
+		if (i + 1 < iter) free(list);
+	}
+	printf("getUserList:     %8.2f ms\n", elapsed(&t0) * 1e3 / iter);
+
+	/* Albero: buffer riusato (lo stesso della lobby) */
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < iter; i++) {
+		if (getUserListBuf(db.root, WAITING, &buf, &size) != len) {
+			perror("getUserListBuf");
+			return EXIT_FAILURE;
+		}
+	}
+	printf("getUserListBuf:  %8.2f ms\n", elapsed(&t0) * 1e3 / iter);
+
+	if (strcmp(list, buf) != 0) {
+		fprintf(stderr, "liste diverse\n");
+		return EXIT_FAILURE;
+	}
+	free(list);
+	free(buf);
+	freeUserDb(&db);
+	return 0;
+}
@@ -0,0 +1,140 @@
+/**
+ *  \file benchload.c
+ *  \author Orlando Leombruni
+ *
+ *  \brief Generatore di file degli utenti e benchmark del caricamento all'avvio del server.
+ *
+ *  Uso: <tt>benchload [-n utenti] [-r] file</tt>
+ *
+ *  Con \c -n scrive in \c file \c n utenti nel formato \c nome_utente:password, in ordine
+ *  lessicografico (come li salva \c storeUsers) o in ordine casuale con \c -r. Poi misura il
+ *  tempo per caricare \c file con \c loadUsers, con \c loadUsersDb (albero ed indice hash) e,
+ *  come confronto, leggendolo una riga alla volta ed inserendo gli utenti uno per uno con
+ *  \c addUser, e stampa l'altezza degli alberi ottenuti.
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "users.h"
+#include "bench.h"
+
+/** Lunghezza massima di una riga del file degli utenti */
+#define LLINE (LUSER + LPWD + 3)
+
+/** Scrive in \c path \c n utenti, in ordine lessicografico o (se \c shuffle) casuale;
+    restituisce -1 in caso di errore */
+static int generate(char* path, unsigned int n, bool_t shuffle) {
+	FILE* f = NULL;
+	unsigned int *v = NULL, i, j, tmp, seed = 2013;
+	if ((v = (unsigned int*)malloc(n * sizeof(unsigned int))) == NULL) return -1;
+	for (i = 0; i < n; i++) v[i] = i;
+	if (shuffle) {
+		for (i = n - 1; i > 0; i--) {
+			seed = seed * 1103515245u + 12345u;
+			j = ((seed >> 8) ^ (i * 2654435761u)) % (i + 1);
+			tmp = v[i];
+			v[i] = v[j];
+			v[j] = tmp;
+		}
+	}
+	if ((f = fopen(path, "w")) == NULL) {
+		free(v);
+		return -1;
+	}
+	for (i = 0; i < n; i++) fprintf(f, "u%08u:p%07u\n", v[i], v[i] % 10000000);
+	free(v);
+	return fclose(f);
+}
+
+/** Caricamento riga per riga con inserimenti singoli (il vecchio schema di \c loadUsers) */
+static int loadByLine(FILE* fin, nodo_t** r) {
+	char line[LLINE + 1], *nl = NULL;
+	user_t* pu = NULL;
+	int n = 0, res;
+	while (fgets(line, LLINE + 1, fin) != NULL) {
+		if ((nl = strchr(line, '\n')) == NULL) {
+			errno = EINVAL;
+			return -1;
+		}
+		*nl = '\0';
+		if ((pu = stringToUser(line, LLINE)) == NULL) return -1;
+		if ((res = addUser(r, pu)) == -1) return -1;
+		if (res == 1) free(pu);
+		else n++;
+	}
+	return n;
+}
+
+int main(int argc, char* argv[]) {
+	nodo_t* r = NULL;
+	userdb_t db = USERDB_INITIALIZER;
+	FILE* f = NULL;
+	struct timespec t0;
+	char* path = NULL;
+	unsigned int n = 0;
+	bool_t shuffle = FALSE;
+	int opt, res;
+
+	while ((opt = getopt(argc, argv, "n:r")) != -1) {
+		switch (opt) {
+			case 'n': n = atoi(optarg); break;
+			case 'r': shuffle = TRUE; break;
+			default:
+				fprintf(stderr, "uso: %s [-n utenti] [-r] file\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (optind != argc - 1) {
+		fprintf(stderr, "uso: %s [-n utenti] [-r] file\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	path = argv[optind];
+
+	if (n > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		if (generate(path, n, shuffle) == -1) {
+			perror(path);
+			return EXIT_FAILURE;
+		}
+		printf("generati %u utenti (%s) in %.3f s\n", n, shuffle ? "ordine casuale" : "ordinati", elapsed(&t0));
+	}
+
+	if ((f = fopen(path, "r")) == NULL) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if ((res = loadUsers(f, &r)) == -1) {
+		perror("loadUsers");
+		return EXIT_FAILURE;
+	}
+	printf("loadUsers:   %8d utenti in %.3f s (altezza %u)\n", res, elapsed(&t0), (r != NULL) ? r->height : 0);
+	freeTree(r);
+	r = NULL;
+
+	rewind(f);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if ((res = loadUsersDb(f, &db)) == -1) {
+		perror("loadUsersDb");
+		return EXIT_FAILURE;
+	}
+	printf("loadUsersDb: %8d utenti in %.3f s (altezza %u)\n", res, elapsed(&t0), (db.root != NULL) ? db.root->height : 0);
+	freeUserDb(&db);
+
+	rewind(f);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if ((res = loadByLine(f, &r)) == -1) {
+		perror("addUser");
+		return EXIT_FAILURE;
+	}
+	printf("riga per riga: %6d utenti in %.3f s (altezza %u)\n", res, elapsed(&t0), (r != NULL) ? r->height : 0);
+	freeTree(r);
+	fclose(f);
+	return 0;
+}
@@ -0,0 +1,303 @@
+/**
+ *  \file benchlookup.c
+ *  \author Orlando Leombruni
+ *
+ *  \brief Benchmark della contesa sull'archivio degli utenti: ricerche concorrenti (come quelle delle
+ *  funzioni \c *_Mutex di brsserver.c) mentre altri thread aggiornano lo stato degli utenti e
+ *  registrano e cancellano utenti.
+ *
+ *  Uso: <tt>benchlookup [-m mutex|stripe|epoch] [-u utenti] [-t thread] [-s secondi] [-w scrittori]
+ *  [-r registrazioni]</tt>
+ *
+ *  Per ogni numero di thread lettori (1, 2, 4, ... fino a \c -t) stampa le ricerche al secondo,
+ *  totali e per thread. Con \c -m \c mutex ogni accesso all'archivio passa da un unico mutex; con
+ *  \c -m \c stripe le ricerche prendono in lettura il lock lettori/scrittori dell'albero ed il lock
+ *  di riga dell'utente; con \c -m \c epoch le ricerche non prendono alcun lock e passano
+ *  dall'indice hash in una sezione di lettura (\c epochEnter, \c epochExit), come nel server.
+ *  I thread di registrazione (\c -r) inseriscono e cancellano a blocchi utenti nuovi (in mutua
+ *  esclusione sull'albero), per cui l'indice viene ridimensionato e i nodi riciclati mentre
+ *  i lettori lo percorrono; al termine viene controllato che l'archivio contenga esattamente
+ *  gli utenti iniziali.
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "users.h"
+#include "epoch.h"
+
+/** Numero di lock di riga (come in brsserver.c) */
+#define NSTRIPES 64
+/** Numero massimo di thread */
+#define MAXTHREADS 256
+/** Utenti inseriti (e poi cancellati) in blocco da un thread di registrazione */
+#define REGBATCH 4096
+
+/** Schemi di sincronizzazione confrontati */
+typedef enum lockmode { M_MUTEX, M_STRIPE, M_EPOCH } lockmode_t;
+
+/** Contatore di operazioni di un thread (allineato per evitare la condivisione di linee di cache) */
+typedef struct counter {
+	/** Operazioni eseguite */
+	unsigned long ops;
+	/** Riempimento fino a 64 byte */
+	char pad[64 - sizeof(unsigned long)];
+} counter_t;
+
+/** Schema di sincronizzazione in uso */
+static lockmode_t mode = M_STRIPE;
+/** Archivio degli utenti */
+static userdb_t db = USERDB_INITIALIZER;
+/** Numero di utenti dell'archivio */
+static unsigned int nusers = 1000000;
+/** Mutex globale (schema \c M_MUTEX) */
+static pthread_mutex_t big_mutex = PTHREAD_MUTEX_INITIALIZER;
+/** Lock lettori/scrittori sull'albero (schemi \c M_STRIPE e \c M_EPOCH) */
+static pthread_rwlock_t tree_lock = PTHREAD_RWLOCK_INITIALIZER;
+/** Lock di riga (schemi \c M_STRIPE e \c M_EPOCH) */
+static pthread_mutex_t user_stripe[NSTRIPES];
+/** Diventa 1 alla fine di una misura */
+static int stop = 0;
+/** Numero di ricerche fallite e di errori dei thread di registrazione */
+static unsigned long errors = 0;
+/** Contatori dei thread lettori */
+static counter_t readers[MAXTHREADS];
+/** Contatori dei thread scrittori */
+static counter_t writers[MAXTHREADS];
+/** Contatori dei thread di registrazione */
+static counter_t registrars[MAXTHREADS];
+/** Nomi degli schemi (opzione \c -m) */
+static char* modes[] = { "mutex", "stripe", "epoch" };
+
+/** Lock di riga di uno username (hash djb2, come la \c StripeOf del server) */
+static unsigned int stripeOf(char* u) {
+	unsigned int h = 5381;
+	while (*u != '\0') h = h*33 + (unsigned char)*(u++);
+	return h % NSTRIPES;
+}
+
+/** Generatore pseudocasuale xorshift (stato locale al thread) */
+static unsigned int nextRand(unsigned int* s) {
+	(*s) ^= (*s) << 13;
+	(*s) ^= (*s) >> 17;
+	(*s) ^= (*s) << 5;
+	return *s;
+}
+
+/** Username dell'i-esimo utente */
+static void userName(char* s, unsigned int i) {
+	sprintf(s, "u%08u", i);
+}
+
+/** Cerca un utente e ne legge lo stato (-1 se non esiste) */
+static int lookup(char* u) {
+	nodo_t* n = NULL;
+	int st = -1;
+	unsigned int s = 0;
+	switch (mode) {
+		case M_MUTEX:
+			pthread_mutex_lock(&big_mutex);
+			if ((n = findUserDb(&db, u)) != NULL) st = __atomic_load_n(&(n->status), __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&big_mutex);
+			break;
+		case M_STRIPE:
+			s = stripeOf(u);
+			pthread_rwlock_rdlock(&tree_lock);
+			pthread_mutex_lock(&user_stripe[s]);
+			if ((n = findUserDb(&db, u)) != NULL) st = __atomic_load_n(&(n->status), __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&user_stripe[s]);
+			pthread_rwlock_unlock(&tree_lock);
+			break;
+		case M_EPOCH:
+			if (epochEnter() == -1) return -1;
+			if ((n = findUserDb(&db, u)) != NULL) st = __atomic_load_n(&(n->status), __ATOMIC_RELAXED);
+			epochExit();
+			break;
+	}
+	return st;
+}
+
+/** Aggiorna il canale di un utente */
+static void update(char* u, int ch) {
+	nodo_t* n = NULL;
+	unsigned int s = 0;
+	switch (mode) {
+		case M_MUTEX:
+			pthread_mutex_lock(&big_mutex);
+			if ((n = findUserDb(&db, u)) != NULL) __atomic_store_n(&(n->channel), ch, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&big_mutex);
+			break;
+		case M_STRIPE:
+		case M_EPOCH:
+			s = stripeOf(u);
+			pthread_rwlock_rdlock(&tree_lock);
+			pthread_mutex_lock(&user_stripe[s]);
+			if ((n = findUserDb(&db, u)) != NULL) __atomic_store_n(&(n->channel), ch, __ATOMIC_RELAXED);
+			pthread_mutex_unlock(&user_stripe[s]);
+			pthread_rwlock_unlock(&tree_lock);
+			break;
+	}
+}
+
+/** Thread lettore: ricerche di utenti a caso fino alla fine della misura */
+static void* reader(void* arg) {
+	counter_t* c = (counter_t*)arg;
+	unsigned int seed = (unsigned int)(c - readers) * 2654435761u + 1;
+	char u[LUSER + 1];
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		userName(u, nextRand(&seed) % nusers);
+		if (lookup(u) != -1) c->ops++;
+		else __atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+/** Thread scrittore: aggiornamenti di utenti a caso fino alla fine della misura */
+static void* writer(void* arg) {
+	counter_t* c = (counter_t*)arg;
+	unsigned int seed = (unsigned int)(c - writers) * 2246822519u + 7;
+	char u[LUSER + 1];
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		userName(u, nextRand(&seed) % nusers);
+		update(u, (int)c->ops);
+		c->ops++;
+	}
+	return NULL;
+}
+
+/** Inserisce o cancella un utente in mutua esclusione sull'albero (-1 in caso di errore) */
+static int reg(user_t* pu, bool_t add) {
+	int res;
+	if (mode == M_MUTEX) pthread_mutex_lock(&big_mutex);
+	else pthread_rwlock_wrlock(&tree_lock);
+	res = add ? addUserDb(&db, pu) : removeUserDb(&db, pu);
+	if (mode == M_MUTEX) pthread_mutex_unlock(&big_mutex);
+	else pthread_rwlock_unlock(&tree_lock);
+	return res;
+}
+
+/** Thread di registrazione: inserisce e cancella blocchi di utenti nuovi fino alla fine della misura */
+static void* registrar(void* arg) {
+	counter_t* c = (counter_t*)arg;
+	user_t u, *pu = NULL;
+	int i;
+	strcpy(u.passwd, "pw");
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		for (i = 0; i < REGBATCH; i++) {
+			if ((pu = (user_t*)malloc(sizeof(user_t))) == NULL) break;
+			sprintf(pu->name, "r%03d_%05d", (int)(c - registrars), i);
+			strcpy(pu->passwd, u.passwd);
+			if (reg(pu, TRUE) != 0) {
+				free(pu);
+				break;
+			}
+		}
+		if (i < REGBATCH) break;
+		for (i = 0; i < REGBATCH; i++) {
+			sprintf(u.name, "r%03d_%05d", (int)(c - registrars), i);
+			if (reg(&u, FALSE) != 0) break;
+		}
+		if (i < REGBATCH) break;
+		c->ops += 2*REGBATCH;
+	}
+	if (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) __atomic_add_fetch(&errors, 1, __ATOMIC_RELAXED);
+	return NULL;
+}
+
+/** Somma dei contatori di \c n thread */
+static unsigned long total(counter_t* c, int n) {
+	unsigned long t = 0;
+	int i;
+	for (i = 0; i < n; i++) t += c[i].ops;
+	return t;
+}
+
+int main(int argc, char* argv[]) {
+	pthread_t tid[3*MAXTHREADS];
+	user_t* pu = NULL;
+	char u[LUSER + 1];
+	unsigned int i;
+	int opt, t, j, maxthreads = 2*sysconf(_SC_NPROCESSORS_ONLN), seconds = 2, nwriters = 1, nregs = 0;
+	unsigned long r, w, g;
+
+	while ((opt = getopt(argc, argv, "m:u:t:s:w:r:")) != -1) {
+		switch (opt) {
+			case 'm':
+				if (strcmp(optarg, modes[M_MUTEX]) == 0) mode = M_MUTEX;
+				else if (strcmp(optarg, modes[M_STRIPE]) == 0) mode = M_STRIPE;
+				else if (strcmp(optarg, modes[M_EPOCH]) == 0) mode = M_EPOCH;
+				else {
+					fprintf(stderr, "schema sconosciuto: %s\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'u': nusers = atoi(optarg); break;
+			case 't': maxthreads = atoi(optarg); break;
+			case 's': seconds = atoi(optarg); break;
+			case 'w': nwriters = atoi(optarg); break;
+			case 'r': nregs = atoi(optarg); break;
+			default:
+				fprintf(stderr, "uso: %s [-m mutex|stripe|epoch] [-u utenti] [-t thread] [-s secondi] [-w scrittori] [-r registrazioni]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (nusers == 0 || maxthreads < 1 || maxthreads > MAXTHREADS || nwriters < 0 || nwriters > MAXTHREADS
+		|| nregs < 0 || nregs > MAXTHREADS) {
+		fprintf(stderr, "parametri non validi\n");
+		return EXIT_FAILURE;
+	}
+	for (j = 0; j < NSTRIPES; j++) pthread_mutex_init(&user_stripe[j], NULL);
+
+	/* Popolazione dell'archivio */
+	for (i = 0; i < nusers; i++) {
+		if ((pu = (user_t*)malloc(sizeof(user_t))) == NULL) {
+			perror("malloc");
+			return EXIT_FAILURE;
+		}
+		userName(pu->name, i);
+		strcpy(pu->passwd, "pw");
+		if (addUserDb(&db, pu) != 0) {
+			perror("addUserDb");
+			return EXIT_FAILURE;
+		}
+	}
+	printf("schema %s, %u utenti, %d scrittori, %d thread di registrazione, %d s per misura\n",
+		modes[mode], nusers, nwriters, nregs, seconds);
+
+	for (t = 1; t <= maxthreads; t = (t < maxthreads && 2*t > maxthreads) ? maxthreads : 2*t) {
+		memset(readers, 0, sizeof(readers));
+		memset(writers, 0, sizeof(writers));
+		memset(registrars, 0, sizeof(registrars));
+		__atomic_store_n(&stop, 0, __ATOMIC_RELAXED);
+		for (j = 0; j < t; j++) pthread_create(&tid[j], NULL, reader, &readers[j]);
+		for (j = 0; j < nwriters; j++) pthread_create(&tid[t + j], NULL, writer, &writers[j]);
+		for (j = 0; j < nregs; j++) pthread_create(&tid[t + nwriters + j], NULL, registrar, &registrars[j]);
+		sleep(seconds);
+		__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+		for (j = 0; j < t + nwriters + nregs; j++) pthread_join(tid[j], NULL);
+		r = total(readers, t);
+		w = total(writers, nwriters);
+		g = total(registrars, nregs);
+		printf("%3d lettori: %12.0f ricerche/s (%10.0f per thread), %10.0f aggiornamenti/s, %9.0f registrazioni/s\n",
+			t, (double)r/seconds, (double)r/seconds/t, (double)w/seconds, (double)g/seconds);
+		if (t == maxthreads) break;
+	}
+
+	/* Controllo finale: restano esattamente gli utenti iniziali */
+	for (i = 0; i < nusers; i++) {
+		userName(u, i);
+		if (findUserDb(&db, u) == NULL) errors++;
+	}
+	if (errors > 0 || db.nusers != nusers) {
+		fprintf(stderr, "errori: %lu (utenti nell'archivio: %u, attesi %u)\n", errors, db.nusers, nusers);
+		return EXIT_FAILURE;
+	}
+	freeUserDb(&db);
+	return 0;
+}
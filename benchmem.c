@@ -0,0 +1,110 @@
+/**
+ *  \file benchmem.c
+ *  \author Orlando Leombruni
+ *
+ *  \brief Benchmark dell'occupazione di memoria e delle ricerche su un archivio di utenti grande.
+ *
+ *  Uso: <tt>benchmem [-n utenti] [-l ricerche]</tt>
+ *
+ *  Scrive \c n utenti in ordine lessicografico in un file temporaneo (come li salva
+ *  \c storeUsers), li carica con \c loadUsersDb come all'avvio del server e stampa la dimensione
+ *  di un nodo, il picco di memoria residente del processo (\c ru_maxrss di \c getrusage) prima e
+ *  dopo il caricamento, i byte per utente, ed il tempo medio di \c l ricerche di utenti a caso
+ *  sull'albero (\c findUser) e sull'indice hash (\c findUserDb).
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "users.h"
+#include "bench.h"
+
+/** Username dell'i-esimo utente */
+static void userName(char* s, unsigned int i) {
+	sprintf(s, "u%08u", i);
+}
+
+/** Picco di memoria residente del processo in KiB (-1 in caso di errore) */
+static long maxRss(void) {
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru) == -1) return -1;
+	return ru.ru_maxrss;
+}
+
+/** Tempo medio in ns di \c nlookup ricerche di utenti a caso fra gli \c n dell'archivio,
+    sull'indice hash se \c hash, altrimenti sull'albero */
+static double lookups(userdb_t* db, unsigned int n, unsigned int nlookup, bool_t hash) {
+	struct timespec t0;
+	char u[LUSER + 1];
+	unsigned int i, seed = 12345, found = 0;
+	nodo_t* p = NULL;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < nlookup; i++) {
+		seed = seed * 1103515245u + 12345u;
+		userName(u, seed % n);
+		p = hash ? findUserDb(db, u) : findUser(db->root, u);
+		if (p != NULL) found++;
+	}
+	if (found != nlookup) fprintf(stderr, "ricerche fallite: %u\n", nlookup - found);
+	return elapsed(&t0) * 1e9 / nlookup;
+}
+
+int main(int argc, char* argv[]) {
+	userdb_t db = USERDB_INITIALIZER;
+	FILE* f = NULL;
+	struct timespec t0;
+	char u[LUSER + 1];
+	unsigned int n = 10000000, nlookup = 5000000, i;
+	long rss0, rss1;
+	int opt, res;
+
+	while ((opt = getopt(argc, argv, "n:l:")) != -1) {
+		switch (opt) {
+			case 'n': n = atoi(optarg); break;
+			case 'l': nlookup = atoi(optarg); break;
+			default:
+				fprintf(stderr, "uso: %s [-n utenti] [-l ricerche]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (n == 0 || n > 100000000 || nlookup == 0) {
+		fprintf(stderr, "parametri non validi\n");
+		return EXIT_FAILURE;
+	}
+
+	if ((f = tmpfile()) == NULL) {
+		perror("tmpfile");
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < n; i++) {
+		userName(u, i);
+		fprintf(f, "%s:p%07u\n", u, i % 10000000);
+	}
+	if (fflush(f) != 0) {
+		perror("tmpfile");
+		return EXIT_FAILURE;
+	}
+	rewind(f);
+
+	rss0 = maxRss();
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	if ((res = loadUsersDb(f, &db)) != n) {
+		perror("loadUsersDb");
+		return EXIT_FAILURE;
+	}
+	printf("loadUsersDb: %u utenti in %.3f s (altezza %u)\n", n, elapsed(&t0), db.root->height);
+	fclose(f);
+	rss1 = maxRss();
+	printf("sizeof(nodo_t): %zu byte\n", sizeof(nodo_t));
+	printf("ru_maxrss: %ld KiB prima, %ld KiB dopo il caricamento (%.1f byte/utente)\n",
+		rss0, rss1, (rss1 - rss0) * 1024.0 / n);
+
+	printf("findUser:   %8.1f ns/ricerca\n", lookups(&db, n, nlookup, FALSE));
+	printf("findUserDb: %8.1f ns/ricerca\n", lookups(&db, n, nlookup, TRUE));
+	freeUserDb(&db);
+	return 0;
+}
@@ -0,0 +1,107 @@
+/**
+ *  \file benchtree.c
+ *  \author Orlando Leombruni
+ *
+ *  \brief Benchmark delle ricerche sull'albero degli utenti al crescere del numero di utenti.
+ *
+ *  Uso: <tt>benchtree [-m log2 max utenti] [-l ricerche]</tt>
+ *
+ *  Per 2^14, 2^15, ... utenti inseriti in ordine lessicografico (il caso peggiore per un albero
+ *  di ricerca non bilanciato, in cui l'altezza sarebbe pari al numero di utenti) l'albero viene
+ *  salvato su file con \c storeUsers e ricaricato con \c loadUsers, come al riavvio del server.
+ *  Per entrambi gli alberi stampa l'altezza ed il tempo medio di una ricerca con \c findUser:
+ *  l'altezza cresce di 1 ad ogni raddoppio e il tempo di ricerca cresce in modo logaritmico.
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "users.h"
+#include "bench.h"
+
+/** Username dell'i-esimo utente */
+static void userName(char* s, unsigned int i) {
+	sprintf(s, "u%08u", i);
+}
+
+/** Tempo medio in ns di \c nlookup ricerche di utenti a caso fra gli \c n dell'albero */
+static double lookups(nodo_t* r, unsigned int n, unsigned int nlookup) {
+	struct timespec t0;
+	char u[LUSER + 1];
+	unsigned int i, seed = 12345, found = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < nlookup; i++) {
+		seed = seed * 1103515245u + 12345u;
+		userName(u, seed % n);
+		if (findUser(r, u) != NULL) found++;
+	}
+	if (found != nlookup) fprintf(stderr, "ricerche fallite: %u\n", nlookup - found);
+	return elapsed(&t0) * 1e9 / nlookup;
+}
+
+int main(int argc, char* argv[]) {
+	nodo_t* r = NULL;
+	user_t* pu = NULL;
+	FILE* f = NULL;
+	unsigned int n, i, nlookup = 1000000;
+	int opt, maxlog = 20, k, res;
+	double add, find;
+
+	while ((opt = getopt(argc, argv, "m:l:")) != -1) {
+		switch (opt) {
+			case 'm': maxlog = atoi(optarg); break;
+			case 'l': nlookup = atoi(optarg); break;
+			default:
+				fprintf(stderr, "uso: %s [-m log2 max utenti] [-l ricerche]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (maxlog < 14 || maxlog > 26 || nlookup == 0) {
+		fprintf(stderr, "parametri non validi\n");
+		return EXIT_FAILURE;
+	}
+
+	printf("%10s %8s %12s %8s %12s\n", "utenti", "altezza", "ns/ricerca", "ricar.", "ns/ricerca");
+	for (k = 14; k <= maxlog; k++) {
+		n = 1u << k;
+		/* Inserimento in ordine: l'albero resta bilanciato grazie alle rotazioni */
+		for (i = 0; i < n; i++) {
+			if ((pu = (user_t*)malloc(sizeof(user_t))) == NULL) {
+				perror("malloc");
+				return EXIT_FAILURE;
+			}
+			userName(pu->name, i);
+			strcpy(pu->passwd, "pw");
+			if (addUser(&r, pu) != 0) {
+				perror("addUser");
+				return EXIT_FAILURE;
+			}
+		}
+		add = lookups(r, n, nlookup);
+		printf("%10u %8u %12.1f", n, r->height, add);
+
+		/* Salvataggio e ricaricamento dal file ordinato */
+		if ((f = tmpfile()) == NULL || storeUsers(f, r) != n) {
+			perror("storeUsers");
+			return EXIT_FAILURE;
+		}
+		freeTree(r);
+		r = NULL;
+		rewind(f);
+		if ((res = loadUsers(f, &r)) != n) {
+			perror("loadUsers");
+			return EXIT_FAILURE;
+		}
+		fclose(f);
+		find = lookups(r, n, nlookup);
+		printf(" %8u %12.1f\n", r->height, find);
+		fflush(stdout);
+		freeTree(r);
+		r = NULL;
+	}
+	return 0;
+}
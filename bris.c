@@ -323,3 +323,85 @@ bool_t checkIfFinish (carta_t* first[], carta_t* second[])
 	}
 	return result;
 }
+
+/** Ripete un elemento per le dieci carte di un seme */
+#define PERSEME(x) x, x, x, x, x, x, x, x, x, x
+/** Valori delle carte di un seme, in ordine */
+#define VALORI ASSO, DUE, TRE, QUATTRO, CINQUE, SEI, SETTE, FANTE, DONNA, RE
+/** Punti delle carte di un seme, in ordine di valore */
+#define PUNTI 11, 0, 10, 0, 0, 0, 0, 2, 3, 4
+/** Forze delle carte di un seme, in ordine di valore (DUE < QUATTRO < ... < RE < TRE < ASSO) */
+#define FORZE 9, 0, 8, 1, 2, 3, 4, 5, 6, 7
+
+const unsigned char card_val[NCARTE] = { VALORI, VALORI, VALORI, VALORI };
+const unsigned char card_seme[NCARTE] = { PERSEME(CUORI), PERSEME(QUADRI), PERSEME(FIORI), PERSEME(PICCHE) };
+const unsigned char card_points[NCARTE] = { PUNTI, PUNTI, PUNTI, PUNTI };
+const unsigned char card_rank[NCARTE] = { FORZE, FORZE, FORZE, FORZE };
+
+/** Carte compatte che battono la carta \c c di seme \c s dato il seme di briscola \c b (tutte
+    tranne le carte dello stesso seme piu' forti, indicate nei 10 bit \c h, e le briscole se
+    \c c non e' una briscola) */
+#define BATTUTE(b, s, h) (SET_ALL & ~(((cardset_t)(h)) << ((s)*10)) & ~(((s) == (b)) ? SET_EMPTY : SEMESET(b)))
+/** Tabella delle carte battute per le dieci carte di un seme, in ordine di valore; le costanti
+    sono gli insiemi (un bit per valore) delle carte dello stesso seme piu' forti */
+#define BATTUTESEME(b, s) BATTUTE(b, s, 0x000), BATTUTE(b, s, 0x3FD), BATTUTE(b, s, 0x001), \
+	BATTUTE(b, s, 0x3F5), BATTUTE(b, s, 0x3E5), BATTUTE(b, s, 0x3C5), BATTUTE(b, s, 0x385), \
+	BATTUTE(b, s, 0x305), BATTUTE(b, s, 0x205), BATTUTE(b, s, 0x005)
+/** Riga della tabella delle prese per la briscola \c b */
+#define BATTUTERIGA(b) { BATTUTESEME(b, CUORI), BATTUTESEME(b, QUADRI), BATTUTESEME(b, FIORI), BATTUTESEME(b, PICCHE) }
+
+const cardset_t trick_table[4][NCARTE] = { BATTUTERIGA(CUORI), BATTUTERIGA(QUADRI), BATTUTERIGA(FIORI), BATTUTERIGA(PICCHE) };
+
+/** Caratteri dei valori, indicizzati per valore */
+static const char val_char[] = "A234567JQK";
+/** Caratteri dei semi, indicizzati per seme */
+static const char seme_char[] = "CQFP";
+/** Valore corrispondente ad un carattere, aumentato di 1 (0 se il carattere non e' un valore) */
+static const unsigned char char_val[256] = {
+	['A'] = ASSO + 1, ['2'] = DUE + 1, ['3'] = TRE + 1, ['4'] = QUATTRO + 1, ['5'] = CINQUE + 1,
+	['6'] = SEI + 1, ['7'] = SETTE + 1, ['J'] = FANTE + 1, ['Q'] = DONNA + 1, ['K'] = RE + 1
+};
+/** Seme corrispondente ad un carattere, aumentato di 1 (0 se il carattere non e' un seme) */
+static const unsigned char char_seme[256] = {
+	['C'] = CUORI + 1, ['Q'] = QUADRI + 1, ['F'] = FIORI + 1, ['P'] = PICCHE + 1
+};
+
+card_t packCard(carta_t* c) {
+	if ((unsigned int)c->val > RE || (unsigned int)c->seme > PICCHE) return NOCARD;
+	return CARD(c->val, c->seme);
+}
+
+void unpackCard(card_t k, carta_t* c) {
+	c->val = CARD_VAL(k);
+	c->seme = CARD_SEME(k);
+}
+
+void packedToString(char* s, card_t k) {
+	s[0] = (k < NCARTE) ? val_char[CARD_VAL(k)] : 'U';
+	s[1] = (k < NCARTE) ? seme_char[CARD_SEME(k)] : 'U';
+	s[2] = '\0';
+}
+
+card_t stringToPacked(char* str) {
+	unsigned char v, sm;
+	if (str == NULL || (v = char_val[(unsigned char)str[0]]) == 0 || (sm = char_seme[(unsigned char)str[1]]) == 0) {
+		errno = EINVAL;
+		return NOCARD;
+	}
+	return CARD(v - 1, sm - 1);
+}
+
+card_t drawPacked(mazzo_t* m) {
+	if (m->next == NCARTE) return NOCARD;
+	return packCard(&(m->carte[m->next++]));
+}
+
+bool_t comparePacked(semi_t briscola, card_t ca, card_t cb) {
+	return TRICK_WINS(briscola, ca, cb);
+}
+
+int setPoints(cardset_t s) {
+	return 11*__builtin_popcountll(s & VALSET(ASSO)) + 10*__builtin_popcountll(s & VALSET(TRE))
+		+ 4*__builtin_popcountll(s & VALSET(RE)) + 3*__builtin_popcountll(s & VALSET(DONNA))
+		+ 2*__builtin_popcountll(s & VALSET(FANTE));
+}
@@ -12,6 +12,7 @@
 #define __BRIS__H
 
 #include <stdio.h>
+#include <stdint.h>
 /** Tipo Booleano */
 typedef enum bool { FALSE, TRUE } bool_t;
 
@@ -41,12 +42,68 @@ typedef struct mazzo {
   semi_t briscola;        
 } mazzo_t;
 
+/** Carta in formato compatto: indice della carta nel mazzo ordinato per seme e valore,
+    <tt>seme*10 + valore</tt> (da 0 a \c NCARTE-1). Valore, seme, punti e forza di una
+    carta compatta si ottengono con un accesso a tabella, e le funzioni che la usano non
+    allocano memoria. */
+typedef unsigned char card_t;
+/** Carta compatta nulla (posizione vuota di una mano, mazzo esaurito, stringa non valida) */
+#define NOCARD ((card_t)0xFF)
+/** Carta compatta di valore \c v e seme \c s */
+#define CARD(v, s) ((card_t)((s)*10 + (v)))
+/** Valore di una carta compatta */
+#define CARD_VAL(c) ((valori_t)card_val[c])
+/** Seme di una carta compatta */
+#define CARD_SEME(c) ((semi_t)card_seme[c])
+/** Punti di una carta compatta */
+#define CARD_POINTS(c) (card_points[c])
+/** Forza di una carta compatta rispetto alle carte dello stesso seme (0 per il DUE, 9 per l'ASSO) */
+#define CARD_RANK(c) (card_rank[c])
+
+/** Insieme di carte (mano, carte prese, carte rimanenti nel mazzo): la carta compatta \c k
+    appartiene all'insieme se il bit \c k e' a 1. Appartenenza, inserimento ed eliminazione
+    sono operazioni sui bit, e i punti si calcolano contando i bit per ciascun valore. */
+typedef uint64_t cardset_t;
+/** Insieme vuoto */
+#define SET_EMPTY ((cardset_t)0)
+/** Insieme di tutte le carte */
+#define SET_ALL ((((cardset_t)1) << NCARTE) - 1)
+/** Insieme contenente la sola carta compatta \c c (vuoto se \c c e' \c NOCARD) */
+#define CARDBIT(c) (((c) < NCARTE) ? ((cardset_t)1) << (c) : SET_EMPTY)
+/** Insieme delle carte di valore \c v (una per seme) */
+#define VALSET(v) (((cardset_t)0x40100401) << (v))
+/** Insieme delle carte di seme \c s */
+#define SEMESET(s) (((cardset_t)0x3FF) << ((s)*10))
+/** TRUE se la carta compatta \c c appartiene all'insieme \c s */
+#define SET_HAS(s, c) ((((s) & CARDBIT(c)) != 0) ? TRUE : FALSE)
+/** Aggiunge la carta compatta \c c all'insieme \c s */
+#define SET_ADD(s, c) ((s) |= CARDBIT(c))
+/** Toglie la carta compatta \c c dall'insieme \c s */
+#define SET_DEL(s, c) ((s) &= ~CARDBIT(c))
+
+/** TRUE se la carta compatta \c ca, giocata per prima, batte \c cb con briscola \c b
+    (un accesso a \c trick_table, senza salti condizionati) */
+#define TRICK_WINS(b, ca, cb) ((bool_t)((trick_table[b][ca] >> (cb)) & 1))
+
+/** Tabella dei valori delle carte compatte */
+extern const unsigned char card_val[NCARTE];
+/** Tabella dei semi delle carte compatte */
+extern const unsigned char card_seme[NCARTE];
+/** Tabella dei punti delle carte compatte */
+extern const unsigned char card_points[NCARTE];
+/** Tabella delle forze delle carte compatte */
+extern const unsigned char card_rank[NCARTE];
+/** Tabella delle prese: il bit \c cb di <tt>trick_table[b][ca]</tt> e' a 1 se la carta compatta
+    \c ca, giocata per prima, batte \c cb con briscola \c b */
+extern const cardset_t trick_table[4][NCARTE];
+
 /** Genera un mazzo di carte mischiato.
     
     \note Richiede che la srand() sia stata gia' invocata con un seed adeguato.
 
     \note ATTENZIONE: questa funzione e' fornita gia' implementata dai docenti 
-    nel modulo oggetto newMazzo.o da inserire nella libreria libbris.a
+    nel modulo oggetto newMazzo.o da inserire nella libreria libbris.a; in sua assenza
+    la libreria usa l'implementazione di newMazzo_r.c (che genera mazzi diversi)
 
     \retval p puntatore al nuovo mazzo 
     \retval NULL se si e' verificato un errore (setta \c errno)
@@ -184,4 +241,59 @@ char semeToChar(semi_t seme);
  * \retval FALSE se la partita continua
  */
 bool_t checkIfFinish (carta_t* first[], carta_t* second[]);
+
+/** Converte una carta in formato compatto.
+ * \param c carta da convertire
+ * 
+ * \retval k carta compatta
+ * \retval NOCARD se \c c->val o \c c->seme non sono definiti nelle relative \c enum
+ */
+card_t packCard(carta_t* c);
+
+/** Converte una carta compatta in struttura.
+ * \param k carta compatta (diversa da \c NOCARD)
+ * \param c struttura di uscita
+ */
+void unpackCard(card_t k, carta_t* c);
+
+/** Stampa una carta compatta nel formato a due caratteri (\c AQ \c 2F etc ...) su stringa
+ * (\c UU se la carta non e' valida).
+ * \param s stringa di uscita (deve essere lunga almeno 3 caratteri)
+ * \param k carta compatta
+ */
+void packedToString(char* s, card_t k);
+
+/** Converte una carta dal formato stringa 2 caratteri al formato compatto, senza allocare memoria.
+ * \param str stringa di ingresso (deve essere lunga almeno 2, converte i primi 2 caratteri)
+ * 
+ * \retval k carta compatta
+ * \retval NOCARD se la stringa non rappresenta una carta (setta \c errno a \c EINVAL)
+ */
+card_t stringToPacked(char* str);
+
+/** Pesca la prossima carta dal mazzo in formato compatto (aggiustando il campo \c next).
+ * \param m mazzo
+ * 
+ * \retval k carta pescata
+ * \retval NOCARD se tutte le carte del mazzo sono gia' state pescate
+ */
+card_t drawPacked(mazzo_t* m);
+
+/** Confronta due carte compatte data la briscola (stessa semantica di \c compareCard), con un
+ * accesso alla tabella delle prese (vedi \c TRICK_WINS).
+ * \param briscola il seme di briscola
+ * \param ca, cb carte da confrontare (ca giocata prima di cb)
+ * 
+ * \retval TRUE se ca batte cb
+ * \retval FALSE altrimenti
+ */
+bool_t comparePacked(semi_t briscola, card_t ca, card_t cb);
+
+/** Calcola l'ammontare complessivo dei punti di un insieme di carte (con un conteggio dei bit
+ * per ciascun valore che porta punti).
+ * \param s insieme di carte da valutare
+ * 
+ * \retval np numero complessivo di punti
+ */
+int setPoints(cardset_t s);
 #endif
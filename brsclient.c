@@ -13,9 +13,9 @@
 #include "users.h"
 #include <time.h>
 
-/** Definizione macro per l'uscita dalla receiveMessage */
+/** Definizione macro per l'uscita dalla receiveMessageBuf */
 #define receive(a, b) \
-			if (receiveMessage(a, b) == -1) { \
+			if (receiveMessageBuf(a, b) == -1) { \
 					if (errno == ENOTCONN) { \
 						fprintf(stderr, "%s\n", SERVER_KILLED); \
 						EC_CLEANUP_NOW\
@@ -85,13 +85,14 @@ void replace_string (char* hand, char* new, char* old) {
 
 /** Funzione della partita (lato client)
  * \param fd_s file descriptor della socket
+ * \param rb buffer di ricezione della connessione
  * \param player stringa contenente il proprio username
  * \param first booleano che indica se si gioca per primi nel primo turno
  * 
  * Ulteriori informazioni sono disponibili nella relazione.
  */
 
-void Play (int fd_s, char* player, bool_t first)
+void Play (int fd_s, rbuf_t* rb, char* player, bool_t first)
 {
 	int winlen, winpoints;
 	bool_t finished = FALSE;
@@ -101,7 +102,7 @@ void Play (int fd_s, char* player, bool_t first)
 	sent.buffer = NULL;
 	
 	/* Ricezione del messaggio di inizio partita */
-	receive(fd_s, &received)
+	receive(rb, &received)
 	if (received.type != MSG_STARTGAME) {
 		fprintf(stdout, MSG_NOT_EXPECTED);
 		EC_CLEANUP_NOW
@@ -133,7 +134,7 @@ void Play (int fd_s, char* player, bool_t first)
 				ec_neg1 ( sendMessage(fd_s, &sent) )
 				free(sent.buffer);
 				sent.buffer = NULL;
-				receive(fd_s, &received)
+				receive(rb, &received)
 				switch (received.type) {
 					case MSG_ERR:
 						fprintf(stdout, "%s\n", received.buffer);
@@ -153,7 +154,7 @@ void Play (int fd_s, char* player, bool_t first)
 		}
 		else {
 			fprintf(stdout, ENEMYTURN_1, enemy); fflush(stdout);
-			receive(fd_s, &received)
+			receive(rb, &received)
 			fprintf(stdout, "%s\n", received.buffer);
 			while (!goodtype) {
 				fprintf(stdout, YOURTURN, player);
@@ -162,7 +163,7 @@ void Play (int fd_s, char* player, bool_t first)
 				ec_neg1( sendMessage(fd_s, &sent) )
 				free(sent.buffer);
 				sent.buffer = NULL;
-				receive(fd_s, &received)
+				receive(rb, &received)
 				switch (received.type) {
 					case MSG_ERR:
 						fprintf(stdout, "%s\n", received.buffer);
@@ -184,7 +185,7 @@ void Play (int fd_s, char* player, bool_t first)
 		}
 		
 		/* Fine turno/partita */
-		receive(fd_s, &received)
+		receive(rb, &received)
 		switch (received.type) {
 			case MSG_CARD:
 				if (received.buffer[0] == 't') first = TRUE;
@@ -216,6 +217,7 @@ void Play (int fd_s, char* player, bool_t first)
 		free(sent.buffer);
 		sent.buffer = NULL;
 	}
+	freeRecvBuffer(rb);
 	ec_neg1 ( closeConnection(fd_s) )
 	return;
 	
@@ -223,6 +225,7 @@ void Play (int fd_s, char* player, bool_t first)
 	
 		if (received.buffer != NULL) free(received.buffer);
 		if (sent.buffer != NULL) free(sent.buffer);
+		freeRecvBuffer(rb);
 		closeConnection(fd_s);
 		
 		exit(1);
@@ -233,9 +236,10 @@ void Play (int fd_s, char* player, bool_t first)
 int main(int argc, char **argv)
 {
 	int fd;
-	bool_t c_option = FALSE, r_option = FALSE, d_option = FALSE, playing = FALSE, first = FALSE;
+	bool_t c_option = FALSE, r_option = FALSE, d_option = FALSE, l_option = FALSE, playing = FALSE, first = FALSE;
 	char* buf = NULL, player[LUSER+1];
 	message_t toSend, toReceive;
+	rbuf_t* rb = NULL;
 	toSend.buffer = NULL;
 	toReceive.buffer = NULL;
 	
@@ -243,15 +247,16 @@ int main(int argc, char **argv)
 	PTRASSERT
 
 	/* Controllo input della riga di comando */
-	if (argc == 1 || argc == 2 || argc > 4) {
+	if (argc == 1 || argc == 2 || argc == 5 || argc > 7) {
 		fprintf(stderr, "%s\n", WR_NUMB_OF_ARGS);
 		fprintf(stderr, "%s\n", CL_RIGHT_WAY);
 		exit(EXIT_FAILURE);
 	}
-	if (argc == 4) {
-		if (strcmp(argv[3], REG_OPTN) == 0) r_option = TRUE;
-		else if (strcmp(argv[3], CANC_OPTN) == 0) c_option = TRUE;
-		else if (strcmp(argv[3], DISC_OPTN) == 0) d_option = TRUE;
+	if (argc >= 4) {
+		if (argc == 4 && strcmp(argv[3], REG_OPTN) == 0) r_option = TRUE;
+		else if (argc == 4 && strcmp(argv[3], CANC_OPTN) == 0) c_option = TRUE;
+		else if (argc == 4 && strcmp(argv[3], DISC_OPTN) == 0) d_option = TRUE;
+		else if (argc > 5 && strcmp(argv[3], LOBBY_OPTN) == 0) l_option = TRUE;
 		else {
 			fprintf(stderr, "%s\n", WRONG_OPTION);
 			fprintf(stderr, "%s\n", CL_RIGHT_WAY);
@@ -261,6 +266,7 @@ int main(int argc, char **argv)
 	
 	/* Apertura della connessione al server */
 	ec_neg1( fd = openConnection(SOCKNAME, NTRIAL, NSEC) )
+	ec_null( rb = createRecvBuffer(fd) )
 	/* Richiesta di registrazione */
 	if (r_option) {
 		toSend.type = MSG_REG;
@@ -271,18 +277,31 @@ int main(int argc, char **argv)
 	else if (d_option) {
 		toSend.type = MSG_DISC;	/* Richiesta di disconnessione forzata */
 	}
+	else if (l_option) {
+		toSend.type = MSG_LOBBY;	/* Richiesta di connessione con una pagina della lista utenti */
+	}
 	else toSend.type = MSG_CONNECT;
 	
-	/* Creazione del primo messaggio */
+	/* Creazione del primo messaggio (nel caso della pagina, preceduto da offset:n_utenti:prefisso:) */
 	toSend.length = (strlen(argv[1]) + strlen(argv[2])) + 3;
+	if (l_option) toSend.length += strlen(argv[4]) + strlen(argv[5]) + ((argc == 7) ? strlen(argv[6]) : 0) + 3;
 	ec_null ( buf = (char*)malloc((toSend.length)*sizeof(char)) )
 	
-	strcpy(buf, argv[1]);
+	buf[0] = '\0';
+	if (l_option) {
+		strcat(buf, argv[4]);
+		strcat(buf, ":");
+		strcat(buf, argv[5]);
+		strcat(buf, ":");
+		if (argc == 7) strcat(buf, argv[6]);
+		strcat(buf, ":");
+	}
+	strcat(buf, argv[1]);
 	strcat(buf, ":");
 	strcat(buf, argv[2]);
 	toSend.buffer = buf;
 	ec_neg1( sendMessage(fd, &toSend) )
-	receive(fd, &toReceive)
+	receive(rb, &toReceive)
 	
 	if (c_option || r_option || d_option) { /* Caso registrazione/rimozione/disconnessione */
 		explainMsg_rc(toReceive);
@@ -294,6 +313,7 @@ int main(int argc, char **argv)
 			free(toSend.buffer);
 			toSend.buffer = NULL;
 		}
+		freeRecvBuffer(rb);
 		ec_neg1 ( closeConnection(fd) )
 		return 0;
 	}
@@ -312,7 +332,7 @@ int main(int argc, char **argv)
 				ec_neg1( sendMessage(fd, &toSend) )
 				free(toReceive.buffer);
 				toReceive.buffer = NULL;
-				receive(fd, &toReceive)
+				receive(rb, &toReceive)
 				if (toReceive.type != MSG_OK) {
 					fprintf(stdout, MSG_NOT_EXPECTED);
 					EC_CLEANUP_NOW
@@ -327,7 +347,7 @@ int main(int argc, char **argv)
 				ec_neg1 ( sendMessage(fd, &toSend) )
 				free(toReceive.buffer);
 				toReceive.buffer = NULL;
-				receive(fd, &toReceive)
+				receive(rb, &toReceive)
 				if (toReceive.type != MSG_OK) {
 					explainMsg_rc(toReceive);
 					EC_CLEANUP_NOW
@@ -353,7 +373,8 @@ int main(int argc, char **argv)
 			break;
 	}
 	
-	if (playing) Play(fd, argv[1], first);	
+	if (playing) Play(fd, rb, argv[1], first);
+	else freeRecvBuffer(rb);
 	
 	return 0;
 	
@@ -361,6 +382,7 @@ int main(int argc, char **argv)
 		
 		if (toReceive.buffer != NULL) free(toReceive.buffer);
 		if (toSend.buffer != NULL) free(toSend.buffer);
+		freeRecvBuffer(rb);
 		closeConnection(fd);
 		
 		return 1;
@@ -7,66 +7,166 @@
  * 
  */
 #include <signal.h>
+#include <limits.h>
 #include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 #include "commonstrings.h"
 #include "errors.h"
 #include "comsock.h"
 #include "bris.h"
 #include "users.h"
+#include "epoch.h"
+#include "journal.h"
 #include "newMazzo_r.h"
+#include "game.h"
 
-/** Struttura a lista per la gestione dei thread */
+/** Struttura a lista doppiamente concatenata per la gestione dei thread */
 typedef struct _tlist {
-/** ID del thread */
-	pthread_t tid;
+/** File descriptor della connessione servita dal thread (-1 per i thread del pool) */
+	int fd;
+/** Elemento precedente */
+	struct _tlist* prev;
 /** Elemento successivo */
 	struct _tlist* next;
 } tlist;
 
-/** Inserimento di un nuovo thread_id in coda nella struttura a lista
- * 
- * \param list_h testa della lista
- * \param list_t coda della lista
- * \param el thread_id da inserire
- * 
- * \retval list_h testa della lista, se l'elemento è stato inserito
- * \retval NULL se non è stato possibile inserire l'elemento (setta \c errno)
- *
- */
-tlist* NuovoInCoda(tlist* list_h, pthread_t el)
-{
-	if (list_h == NULL) {
-		tlist* new = NULL;
-		if ((new = (tlist*)malloc(sizeof(tlist))) == NULL) return NULL;
-		new->tid = el;
-		new->next = NULL;
-		list_h = new;
-	}
-	else list_h->next = NuovoInCoda(list_h->next, el);
-	return list_h;
-}
+/** Buffer per la costruzione delle liste di utenti, riusato fra le chiamate di uno stesso thread */
+typedef struct _listbuf {
+/** Buffer (\c NULL se non ancora allocato) */
+	char* buf;
+/** Dimensione del buffer */
+	size_t size;
+} listbuf_t;
+
+/** Lista degli utenti in attesa condivisa fra le connessioni: immutabile, con contatore dei riferimenti */
+typedef struct _lobbycache {
+/** Riferimenti (uno della cache, se è la lista corrente, e uno per ogni thread che la sta usando) */
+	int refs;
+/** Versione della lobby a cui corrisponde la lista */
+	unsigned long version;
+/** Lista degli utenti in attesa (formato user1:user2:...:userN) */
+	char* payload;
+} lobbycache_t;
 
 /* Variabili globali */
 
 /** Mutex per la gestione di \c term_signal */
 static pthread_mutex_t sig_mutex = PTHREAD_MUTEX_INITIALIZER;
-/** Mutex per l'albero \c generalTree */
-static pthread_mutex_t tree_mutex = PTHREAD_MUTEX_INITIALIZER;
+/** Lock lettori/scrittori per la struttura dell'albero di \c usersDb (in scrittura solo per inserimenti e rimozioni) */
+static pthread_rwlock_t tree_lock = PTHREAD_RWLOCK_INITIALIZER;
+/** Numero di lock di riga per i campi modificabili degli utenti (status e canale) */
+#define NSTRIPES 64
+/** Lock di riga per status e canale degli utenti, assegnati in base all'hash dello username */
+static pthread_mutex_t user_stripe[NSTRIPES];
+/** Mutex per la lobby di \c usersDb (acquisito dopo il lock di riga, ad ogni cambiamento di stato) */
+static pthread_mutex_t lobby_mutex = PTHREAD_MUTEX_INITIALIZER;
+/** Lista degli utenti in attesa corrente (\c NULL se non ancora costruita), protetta da \c lobby_mutex */
+static lobbycache_t* lobby_cache = NULL;
+/** Numero di connessioni servite con la lista in cache (protetto da \c lobby_mutex) */
+static unsigned long cache_hits = 0;
+/** Numero di ricostruzioni della lista in cache (protetto da \c lobby_mutex) */
+static unsigned long cache_misses = 0;
 /** Mutex per il n. di partite giocate */
 static pthread_mutex_t plays_mutex = PTHREAD_MUTEX_INITIALIZER;
 /** Segnale di STOP per i thread \c Signaler e \c Dispatcher */
 static bool_t term_signal = FALSE;
-/** Albero degli utenti, in mutex fra i thread */
-static nodo_t* generalTree = NULL;
-/** Lista degli ID dei thread Worker (con in coda l'ID del thread attivato più recentemente) */
+/** Archivio degli utenti (albero e lobby degli utenti in attesa), in mutex fra i thread */
+static userdb_t usersDb = USERDB_INITIALIZER;
+/** Journal delle registrazioni e cancellazioni, affiancato al file degli utenti */
+static journal_t journal;
+/** Nome del file degli utenti */
+static char* users_file = NULL;
+/** Processo che sta scrivendo il checkpoint (0 se nessuno), usato dal solo thread \c Signaler */
+static pid_t cp_child = 0;
+/** Mutex per la compattazione del journal (acquisito prima di \c tree_lock) */
+static pthread_mutex_t compact_mutex = PTHREAD_MUTEX_INITIALIZER;
+/** Registro dei thread Worker attivi (con in testa il thread attivato più recentemente) */
 static tlist* threadList_head = NULL;
-/** Opzione di testing (per l'uso della newMazzo thread-safe) */
+/** Mutex per il registro \c threadList_head */
+static pthread_mutex_t threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+/** Variabile di condizione segnalata quando il registro \c threadList_head diventa vuoto */
+static pthread_cond_t threads_cond = PTHREAD_COND_INITIALIZER;
+/** Opzione di testing (mazzi generati dalla \c newMazzo_r in modalità test) */
 static bool_t t_option = FALSE;
+/** Seme da cui derivare i semi delle partite fuori dalla modalità test (sommandogli il numero della partita) */
+static uint64_t seed_base = 0;
+/** Opzione di avvio del server ad eventi (thread \c Reactor al posto di \c Dispatcher e \c Worker) */
+static bool_t e_option = FALSE;
+/** Numero di thread del pool (0 se si usa un thread \c Worker per connessione) */
+static int p_option = 0;
+/** Chiave dei buffer per le liste di utenti (uno per thread, allocato alla prima richiesta) */
+static pthread_key_t list_key;
 /** Variabile che conta il numero progressivo di partite */
 static int npart = 0;
+/** Buffer di ricezione delle connessioni con i client, indicizzati per file descriptor */
+static rbuf_t** conn_rbuf = NULL;
+/** Dimensione della tabella \c conn_rbuf */
+static long conn_max = 0;
+
+/** Associa un nuovo buffer di ricezione alla connessione di un client
+ * 
+ * \param fd file descriptor della connessione
+ * 
+ * \retval rb buffer di ricezione della connessione
+ * \retval NULL se si è verificato un errore (setta \c errno)
+ *
+ * \section commagg0 Commenti Aggiuntivi
+ * Il buffer appartiene alla connessione e non al thread che la gestisce: un client in attesa viene
+ * infatti servito, durante la partita, dal thread dello sfidante, che deve trovare intatti gli eventuali
+ * byte già ricevuti.
+ */
+
+rbuf_t* OpenClient(int fd)
+{
+	if (fd < 0 || fd >= conn_max) {
+		errno = EMFILE;
+		return NULL;
+	}
+	if ((conn_rbuf[fd] = createRecvBuffer(fd)) == NULL) return NULL;
+	return conn_rbuf[fd];
+}
+
+/** Restituisce il buffer di ricezione della connessione di un client
+ * 
+ * \param fd file descriptor della connessione
+ * 
+ * \retval rb buffer di ricezione della connessione
+ * \retval NULL se alla connessione non è associato alcun buffer (setta \c errno)
+ *
+ */
+
+rbuf_t* ClientBuffer(int fd)
+{
+	if (fd < 0 || fd >= conn_max || conn_rbuf[fd] == NULL) {
+		errno = EBADF;
+		return NULL;
+	}
+	return conn_rbuf[fd];
+}
+
+/** Chiude la connessione con un client, deallocandone il buffer di ricezione
+ * 
+ * \param fd file descriptor della connessione
+ * 
+ * \retval 0 se tutto ok
+ * \retval -1 se si è verificato un errore (setta \c errno)
+ *
+ */
+
+int CloseClient(int fd)
+{
+	if (fd >= 0 && fd < conn_max && conn_rbuf[fd] != NULL) {
+		freeRecvBuffer(conn_rbuf[fd]);
+		conn_rbuf[fd] = NULL;
+	}
+	return closeConnection(fd);
+}
 
 /** Esegue la free su un puntatore
- * (è una funzione di cleanup per il thread Dispatcher)
+ * (è una funzione di cleanup per il thread Reactor)
  * 
  * \param arg puntatore all'area di memoria da liberare
  */
@@ -76,27 +176,108 @@ void freefd(void* arg)
 	free(arg);
 }
 
-/** Attende la terminazione di tutti i thread presenti nella lista
+/** Dealloca il buffer per le liste di utenti di un thread
+ * (è il distruttore associato alla chiave \c list_key)
+ * 
+ * \param arg buffer da deallocare
+ */
+
+void FreeListBuffer(void* arg)
+{
+	listbuf_t* lb = (listbuf_t*)arg;
+	free(lb->buf);
+	free(lb);
+}
+
+/** Restituisce il buffer per le liste di utenti del thread chiamante, allocandolo alla prima chiamata
+ * 
+ * \retval lb buffer del thread
+ * \retval NULL se si è verificato un errore (setta \c errno)
+ *
+ * \section commagg8 Commenti Aggiuntivi
+ * Il buffer viene riusato da tutte le richieste servite dal thread (i thread del pool e il thread Reactor servono
+ * più connessioni), per cui viene ingrandito solo quando la lista degli utenti in attesa supera la dimensione
+ * massima raggiunta in precedenza; viene deallocato automaticamente alla terminazione del thread.
+ */
+
+listbuf_t* ListBuffer(void)
+{
+	listbuf_t* lb = NULL;
+	if ((lb = (listbuf_t*)pthread_getspecific(list_key)) != NULL) return lb;
+	if ((lb = (listbuf_t*)calloc(1, sizeof(listbuf_t))) == NULL) return NULL;
+	if ((errno = pthread_setspecific(list_key, lb)) != 0) {
+		free(lb);
+		return NULL;
+	}
+	return lb;
+}
+
+/** Inserimento di un nuovo thread in testa al registro dei thread attivi
+ * 
+ * \param fd file descriptor della connessione servita dal thread (-1 per i thread del pool)
+ * 
+ * \retval el elemento del registro associato al thread
+ * \retval NULL se non è stato possibile inserire l'elemento (setta \c errno)
+ */
+tlist* RegisterThread(int fd)
+{
+	tlist* el = NULL;
+	ec_null ( el = (tlist*)malloc(sizeof(tlist)) )
+	el->fd = fd;
+	el->prev = NULL;
+	ec_rv ( pthread_mutex_lock(&threads_mutex) )
+	el->next = threadList_head;
+	if (threadList_head != NULL) threadList_head->prev = el;
+	threadList_head = el;
+	ec_rv ( pthread_mutex_unlock(&threads_mutex) )
+	return el;
+	
+	EC_CLEANUP_BGN
+		if (el != NULL) free(el);
+		return NULL;
+	EC_CLEANUP_END
+}
+
+/** Rimozione di un thread dal registro dei thread attivi (chiamata dal thread stesso al termine)
+ * 
+ * \param el elemento del registro associato al thread
+ */
+void RemoveThread(tlist* el)
+{
+	ec_rv ( pthread_mutex_lock(&threads_mutex) )
+	if (el->prev != NULL) el->prev->next = el->next;
+	else threadList_head = el->next;
+	if (el->next != NULL) el->next->prev = el->prev;
+	if (threadList_head == NULL) ec_rv ( pthread_cond_broadcast(&threads_cond) )
+	ec_rv ( pthread_mutex_unlock(&threads_mutex) )
+	free(el);
+	return;
+	
+	EC_CLEANUP_BGN
+		pthread_mutex_unlock(&threads_mutex);
+		return;
+	EC_CLEANUP_END
+}
+
+/** Attende che il registro dei thread attivi sia vuoto
  * 
  * \param arg (non usato)
  * 
  * \section commagg1 Commenti Aggiuntivi
- * La funzione è di cleanup per la cancellazione del thread \c Dispatcher; essa opera facendo la join dei thread \c Worker,
- * a partire dal meno recente (quello in testa alla lista). Ciò permette di liberare più rapidamente le aree di memoria
- * occupate dagli elementi della lista, in quanto i thread in testa sono quelli con maggiore probabilità di essere già
- * terminati.
+ * La funzione è di cleanup per la cancellazione del thread \c Dispatcher. I thread \c Worker sono avviati in stato
+ * detached e si rimuovono dal registro al termine, per cui le loro risorse vengono liberate subito; alla chiusura
+ * del server è quindi sufficiente attendere che l'ultimo thread attivo segnali lo svuotamento del registro.
  */
-void joinAllThreads(void* arg)
+void waitAllThreads(void* arg)
 {
-	while (threadList_head != NULL) {
-		tlist* temp = threadList_head;
-		ec_rv ( pthread_join(threadList_head->tid, NULL) )
-		threadList_head = threadList_head->next;
-		free(temp);
-	}
+	ec_rv ( pthread_mutex_lock(&threads_mutex) )
+	while (threadList_head != NULL)
+		ec_rv ( pthread_cond_wait(&threads_cond, &threads_mutex) )
+	ec_rv ( pthread_mutex_unlock(&threads_mutex) )
 	return;
 	
 	EC_CLEANUP_BGN
+		pthread_mutex_unlock(&threads_mutex);
 		return;
 	EC_CLEANUP_END
 }
@@ -138,11 +319,70 @@ void WriteTermSignal()
 	EC_CLEANUP_END
 }
 
-/** addUser in mutex sull'albero \c globalTree
+/** Calcola l'indice del lock di riga associato ad un utente (hash djb2 dello username)
+ * 
+ * \param u username
+ * 
+ * \retval s indice in \c user_stripe
+ */
+unsigned int StripeOf(char* u)
+{
+	unsigned int h = 5381;
+	while (*u != '\0') h = h*33 + (unsigned char)*(u++);
+	return h % NSTRIPES;
+}
+
+/** Compatta il journal nel file degli utenti, se ha raggiunto la dimensione dell'archivio o
+ * se \c force e' TRUE (ad esempio perche' non e' stato possibile accodarvi un'operazione)
+ * 
+ * \param force TRUE per compattare in ogni caso
+ * 
+ * \retval 0 se tutto ok
+ * \retval -1 se si è verificato un errore (setta \c errno)
+ *
+ * \section commagg10 Commenti Aggiuntivi
+ * La compattazione avviene con il lock dell'albero in lettura: le registrazioni e le cancellazioni
+ * attendono, mentre connessioni e partite proseguono. Il costo, proporzionale al numero di utenti,
+ * e' ammortizzato sulle almeno altrettante operazioni accodate al journal dalla compattazione precedente.
+ */
+int CompactUsers(bool_t force)
+{
+	int a = 0;
+	ec_rv ( pthread_mutex_lock(&compact_mutex) )
+	ec_rv ( pthread_rwlock_rdlock(&tree_lock) )
+	if (force || journalFull(&journal, usersDb.nusers)) a = journalCompact(&journal, &usersDb, users_file);
+	ec_rv ( pthread_rwlock_unlock(&tree_lock) )
+	ec_rv ( pthread_mutex_unlock(&compact_mutex) )
+	return (a == -1) ? -1 : 0;
+	
+	EC_CLEANUP_BGN
+		pthread_rwlock_unlock(&tree_lock);
+		pthread_mutex_unlock(&compact_mutex);
+		return -1;
+	EC_CLEANUP_END
+}
+
+/** Rende persistente un'operazione accodata al journal (con numero di sequenza \c seq, 0 se non
+ * e' stato possibile accodarla), compattando il journal se necessario
+ * 
+ * \param seq numero di sequenza dell'operazione
+ * 
+ * \retval 0 se l'operazione e' su disco
+ * \retval -1 se si è verificato un errore (setta \c errno)
+ */
+int CommitUser(unsigned long seq)
+{
+	if (seq == 0 || journalSync(&journal, seq) == -1) return CompactUsers(TRUE);
+	/* Controllo preliminare senza lock dell'albero, ripetuto da CompactUsers */
+	if (journalFull(&journal, __atomic_load_n(&(usersDb.nusers), __ATOMIC_RELAXED))) return CompactUsers(FALSE);
+	return 0;
+}
+
+/** addUserDb in mutex sull'albero \c usersDb, con registrazione nel journal
  * 
  * \param puser utente da inserire
  * 
- * \retval a valore ritornato da addUser
+ * \retval a valore ritornato da addUserDb
  * \retval -1 se si è verificato un errore
  *
  */
@@ -150,22 +390,28 @@ void WriteTermSignal()
 int addUser_Mutex (user_t* puser)
 {
 	int a;
-	ec_rv ( pthread_mutex_lock(&tree_mutex) )
-	a = addUser(&generalTree, puser);
-	ec_rv ( pthread_mutex_unlock(&tree_mutex) )
+	unsigned long seq = 0;
+	user_t u = *puser;	/* puser viene deallocato da addUserDb in caso di successo */
+	ec_rv ( pthread_rwlock_wrlock(&tree_lock) )
+	a = addUserDb(&usersDb, puser);
+	if (a == 0 && journalAppend(&journal, JOURNAL_ADD, &u, &seq) == -1) seq = 0;
+	ec_rv ( pthread_rwlock_unlock(&tree_lock) )
+	/* La scrittura su disco avviene fuori dal lock, insieme a quella delle operazioni concorrenti */
+	if (a == 0 && CommitUser(seq) == -1) return -1;
 	return a;
 	
 	EC_CLEANUP_BGN
-		pthread_mutex_unlock(&tree_mutex);
+		pthread_rwlock_unlock(&tree_lock);
 		return -1;
 	EC_CLEANUP_END
 }
 
-/** removeUser in mutex sull'albero \c globalTree
+/** removeUserDb in mutex sull'albero \c usersDb, con registrazione nel journal
  * 
  * \param puser utente da rimuovere
  * 
- * \retval a valore ritornato da removeUser
+ * \retval a valore ritornato da removeUserDb
+ * \retval ALRCONN se l'utente è connesso (e non viene rimosso)
  * \retval -1 se si è verificato un errore
  *
  */
@@ -173,18 +419,29 @@ int addUser_Mutex (user_t* puser)
 int removeUser_Mutex (user_t* puser)
 {
 	int a;
-	ec_rv ( pthread_mutex_lock(&tree_mutex) )
-	a = removeUser(&generalTree, puser);
-	ec_rv ( pthread_mutex_unlock(&tree_mutex) )
+	unsigned long seq = 0;
+	nodo_t* h = NULL;
+	unsigned int s = StripeOf(puser->name);
+	ec_rv ( pthread_rwlock_wrlock(&tree_lock) )
+	/* Un utente connesso non può essere rimosso: il suo nodo è in uso come handle dalla sessione */
+	h = findUserDb(&usersDb, puser->name);
+	ec_rv ( pthread_mutex_lock(&user_stripe[s]) )
+	if (h != NULL && (h->status != DISCONNECTED || h->channel != -1)) a = ALRCONN;
+	else a = removeUserDb(&usersDb, puser);
+	if (a == 0 && journalAppend(&journal, JOURNAL_DEL, puser, &seq) == -1) seq = 0;
+	ec_rv ( pthread_mutex_unlock(&user_stripe[s]) )
+	ec_rv ( pthread_rwlock_unlock(&tree_lock) )
+	if (a == 0 && CommitUser(seq) == -1) return -1;
 	return a;
 	
 	EC_CLEANUP_BGN
-		pthread_mutex_unlock(&tree_mutex);
+		pthread_mutex_unlock(&user_stripe[s]);
+		pthread_rwlock_unlock(&tree_lock);
 		return -1;
 	EC_CLEANUP_END
 }
 
-/** setUserChannel in mutex sull'albero \c globalTree
+/** setUserChannel in mutex sull'albero \c usersDb (ricerca tramite l'indice hash)
  * 
  * \param puser utente da modificare
  * \param channel canale da settare
@@ -197,18 +454,24 @@ int removeUser_Mutex (user_t* puser)
 bool_t setUserChannel_Mutex (char* puser, int channel)
 {
 	bool_t a;
-	ec_rv ( pthread_mutex_lock(&tree_mutex) )
-	a = setUserChannel(generalTree, puser, channel);
-	ec_rv ( pthread_mutex_unlock(&tree_mutex) )
+	nodo_t* h = NULL;
+	unsigned int s = StripeOf(puser);
+	ec_rv ( pthread_rwlock_rdlock(&tree_lock) )
+	ec_rv ( pthread_mutex_lock(&user_stripe[s]) )
+	if ((h = findUserDb(&usersDb, puser)) != NULL) __atomic_store_n(&(h->channel), channel, __ATOMIC_RELAXED);
+	a = (h != NULL);
+	ec_rv ( pthread_mutex_unlock(&user_stripe[s]) )
+	ec_rv ( pthread_rwlock_unlock(&tree_lock) )
 	return a;
 	
 	EC_CLEANUP_BGN
-		pthread_mutex_unlock(&tree_mutex);
+		pthread_mutex_unlock(&user_stripe[s]);
+		pthread_rwlock_unlock(&tree_lock);
 		return -1;
 	EC_CLEANUP_END
 }
 
-/** setUserStatus in mutex sull'albero \c globalTree
+/** setUserStatusDb in mutex sull'albero \c usersDb e sulla lobby
  * 
  * \param puser utente da modificare
  * \param st status da settare
@@ -221,18 +484,25 @@ bool_t setUserChannel_Mutex (char* puser, int channel)
 bool_t setUserStatus_Mutex (char* puser, status_t st)
 {
 	bool_t a = FALSE;
-	ec_rv ( pthread_mutex_lock(&tree_mutex) )
-	a = setUserStatus(generalTree, puser, st);
-	ec_rv ( pthread_mutex_unlock(&tree_mutex) )
+	unsigned int s = StripeOf(puser);
+	ec_rv ( pthread_rwlock_rdlock(&tree_lock) )
+	ec_rv ( pthread_mutex_lock(&user_stripe[s]) )
+	ec_rv ( pthread_mutex_lock(&lobby_mutex) )
+	a = setUserStatusDb(&usersDb, puser, st);
+	ec_rv ( pthread_mutex_unlock(&lobby_mutex) )
+	ec_rv ( pthread_mutex_unlock(&user_stripe[s]) )
+	ec_rv ( pthread_rwlock_unlock(&tree_lock) )
 	return a;
 	
 	EC_CLEANUP_BGN
-		pthread_mutex_unlock(&tree_mutex);
+		pthread_mutex_unlock(&lobby_mutex);
+		pthread_mutex_unlock(&user_stripe[s]);
+		pthread_rwlock_unlock(&tree_lock);
 		return -1;
 	EC_CLEANUP_END
 }
 
-/** isUser in mutex sull'albero \c globalTree
+/** isUser senza lock sull'albero \c usersDb (ricerca tramite l'indice hash in una sezione di lettura)
  * 
  * \param puser utente da controllare
  * 
@@ -243,18 +513,17 @@ bool_t setUserStatus_Mutex (char* puser, status_t st)
 bool_t isUser_Mutex (char* puser)
 {
 	bool_t a = FALSE;
-	ec_rv ( pthread_mutex_lock(&tree_mutex) )
-	a = isUser(generalTree, puser);
-	ec_rv ( pthread_mutex_unlock(&tree_mutex) )
+	ec_neg1 ( epochEnter() )
+	a = (findUserDb(&usersDb, puser) != NULL);
+	epochExit();
 	return a;
 	
 	EC_CLEANUP_BGN
-		pthread_mutex_unlock(&tree_mutex);
 		return a;
 	EC_CLEANUP_END
 }
 
-/** checkPwd in mutex sull'albero \c globalTree
+/** checkPwd senza lock sull'albero \c usersDb (ricerca tramite l'indice hash in una sezione di lettura)
  * 
  * \param puser utente da controllare
  * 
@@ -265,18 +534,19 @@ bool_t isUser_Mutex (char* puser)
 bool_t checkPwd_Mutex (user_t* puser)
 {
 	bool_t a = FALSE;
-	ec_rv ( pthread_mutex_lock(&tree_mutex) )
-	a = checkPwd(generalTree, puser);
-	ec_rv ( pthread_mutex_unlock(&tree_mutex) )
+	nodo_t* h = NULL;
+	ec_neg1 ( epochEnter() )
+	h = findUserDb(&usersDb, puser->name);
+	a = (h != NULL && strcmp(h->user.passwd, puser->passwd) == 0);
+	epochExit();
 	return a;
 	
 	EC_CLEANUP_BGN
-		pthread_mutex_unlock(&tree_mutex);
 		return a;
 	EC_CLEANUP_END
 }
 
-/** getUserChannel in mutex sull'albero \c globalTree
+/** getUserChannel senza lock sull'albero \c usersDb (ricerca tramite l'indice hash in una sezione di lettura)
  * 
  * \param puser utente da controllare
  * 
@@ -288,18 +558,19 @@ bool_t checkPwd_Mutex (user_t* puser)
 int getUserChannel_Mutex (char* puser)
 {
 	int a;
-	ec_rv ( pthread_mutex_lock(&tree_mutex) )
-	a = getUserChannel(generalTree, puser);
-	ec_rv ( pthread_mutex_unlock(&tree_mutex) )
+	nodo_t* h = NULL;
+	ec_neg1 ( epochEnter() )
+	h = findUserDb(&usersDb, puser);
+	a = (h != NULL) ? __atomic_load_n(&(h->channel), __ATOMIC_RELAXED) : NOTREG;
+	epochExit();
 	return a;
 	
 	EC_CLEANUP_BGN
-		pthread_mutex_unlock(&tree_mutex);
 		return -1;
 	EC_CLEANUP_END
 }
 
-/** getUserStatus in mutex sull'albero \c globalTree
+/** getUserStatus senza lock sull'albero \c usersDb (ricerca tramite l'indice hash in una sezione di lettura)
  * 
  * \param puser utente da controllare
  * 
@@ -311,18 +582,150 @@ int getUserChannel_Mutex (char* puser)
 status_t getUserStatus_Mutex (char* puser)
 {
 	status_t a;
-	ec_rv ( pthread_mutex_lock(&tree_mutex) )
-	a = getUserStatus(generalTree, puser);
-	ec_rv ( pthread_mutex_unlock(&tree_mutex) )
+	nodo_t* h = NULL;
+	ec_neg1 ( epochEnter() )
+	h = findUserDb(&usersDb, puser);
+	a = (h != NULL) ? __atomic_load_n(&(h->status), __ATOMIC_RELAXED) : NOTREG;
+	epochExit();
+	return a;
+	
+	EC_CLEANUP_BGN
+		return -1;
+	EC_CLEANUP_END
+}
+
+/** claimUser in mutex sull'albero \c usersDb, sul lock di riga dell'utente sfidato e sulla lobby
+ * 
+ * \param puser utente da sfidare
+ * \param h puntatore in cui viene memorizzato il nodo dell'utente sfidato
+ * 
+ * \retval a valore ritornato da claimUser
+ * \retval -1 se si è verificato un errore
+ *
+ */
+
+int claimUser_Mutex (char* puser, nodo_t** h)
+{
+	int a;
+	unsigned int s = StripeOf(puser);
+	ec_rv ( pthread_rwlock_rdlock(&tree_lock) )
+	ec_rv ( pthread_mutex_lock(&user_stripe[s]) )
+	ec_rv ( pthread_mutex_lock(&lobby_mutex) )
+	a = claimUser(&usersDb, puser, h);
+	ec_rv ( pthread_mutex_unlock(&lobby_mutex) )
+	ec_rv ( pthread_mutex_unlock(&user_stripe[s]) )
+	ec_rv ( pthread_rwlock_unlock(&tree_lock) )
 	return a;
 	
 	EC_CLEANUP_BGN
-		pthread_mutex_unlock(&tree_mutex);
+		pthread_mutex_unlock(&lobby_mutex);
+		pthread_mutex_unlock(&user_stripe[s]);
+		pthread_rwlock_unlock(&tree_lock);
 		return -1;
 	EC_CLEANUP_END
 }
 
-/** getUserList in mutex sull'albero \c globalTree
+/** updateUser in mutex sul lock di riga dell'utente e sulla lobby (il nodo resta valido per tutta la sessione, in quanto
+ * un utente connesso non può essere rimosso, per cui non è necessario il lock sull'albero)
+ * 
+ * \param h nodo dell'utente
+ * \param st stato da settare
+ * \param ch canale da settare
+ *
+ */
+
+void updateUser_Mutex (nodo_t* h, status_t st, int ch)
+{
+	unsigned int s = StripeOf(h->user.name);
+	ec_rv ( pthread_mutex_lock(&user_stripe[s]) )
+	ec_rv ( pthread_mutex_lock(&lobby_mutex) )
+	updateUser(&usersDb, h, st, ch);
+	ec_rv ( pthread_mutex_unlock(&lobby_mutex) )
+	ec_rv ( pthread_mutex_unlock(&user_stripe[s]) )
+	return;
+	
+	EC_CLEANUP_BGN
+		pthread_mutex_unlock(&lobby_mutex);
+		pthread_mutex_unlock(&user_stripe[s]);
+		return;
+	EC_CLEANUP_END
+}
+
+/** releaseUser in mutex sul lock di riga dell'utente e sulla lobby
+ * 
+ * \param h nodo dell'utente
+ * \param ch canale della sessione da chiudere
+ *
+ */
+
+void releaseUser_Mutex (nodo_t* h, int ch)
+{
+	unsigned int s = StripeOf(h->user.name);
+	ec_rv ( pthread_mutex_lock(&user_stripe[s]) )
+	ec_rv ( pthread_mutex_lock(&lobby_mutex) )
+	releaseUser(&usersDb, h, ch);
+	ec_rv ( pthread_mutex_unlock(&lobby_mutex) )
+	ec_rv ( pthread_mutex_unlock(&user_stripe[s]) )
+	return;
+	
+	EC_CLEANUP_BGN
+		pthread_mutex_unlock(&lobby_mutex);
+		pthread_mutex_unlock(&user_stripe[s]);
+		return;
+	EC_CLEANUP_END
+}
+
+/** Rilascia un riferimento alla lista degli utenti in attesa, deallocandola se era l'ultimo
+ * 
+ * \param lc lista da rilasciare
+ */
+
+void ReleasePayload(lobbycache_t* lc)
+{
+	if (__sync_sub_and_fetch(&(lc->refs), 1) == 0) {
+		free(lc->payload);
+		free(lc);
+	}
+}
+
+/** Restituisce la lista degli utenti in attesa, acquisendone un riferimento; la funzione va chiamata
+ * con \c lobby_mutex acquisito e la lobby non vuota
+ * 
+ * \retval lc lista degli utenti in attesa (da rilasciare con \c ReleasePayload )
+ * \retval NULL se si è verificato un errore (setta \c errno)
+ *
+ * \section commagg9 Commenti Aggiuntivi
+ * Se la versione della lobby non è cambiata dall'ultima costruzione viene restituita la lista in cache, senza
+ * visitare la lobby; altrimenti la lista viene ricostruita e sostituisce quella in cache, che resta valida
+ * per i thread che ne possiedono ancora un riferimento. La copia nel messaggio di risposta può quindi
+ * avvenire dopo il rilascio dei lock.
+ */
+
+lobbycache_t* LobbyPayload(void)
+{
+	lobbycache_t* new = NULL;
+	size_t size = 0;
+	if (lobby_cache != NULL && lobby_cache->version == usersDb.lobbyver) {
+		cache_hits++;
+		__sync_add_and_fetch(&(lobby_cache->refs), 1);
+		return lobby_cache;
+	}
+	cache_misses++;
+	if ((new = (lobbycache_t*)malloc(sizeof(lobbycache_t))) == NULL) return NULL;
+	new->payload = NULL;
+	if (getLobbyListBuf(&usersDb, &(new->payload), &size) <= 0) {
+		free(new->payload);
+		free(new);
+		return NULL;
+	}
+	new->refs = 2;		/* Riferimento della cache e del chiamante */
+	new->version = usersDb.lobbyver;
+	if (lobby_cache != NULL) ReleasePayload(lobby_cache);
+	lobby_cache = new;
+	return new;
+}
+
+/** getUserList in mutex sull'albero \c usersDb
  * 
  * \param st status richiesto
  * 
@@ -330,22 +733,97 @@ status_t getUserStatus_Mutex (char* puser)
  * \retval NULL se nessun utente ha lo status richiesto (errno == 0) o
  * se si è verificato un errore (errno != 0)
  *
+ * La lista degli utenti in attesa è costruita a partire dalla lobby, in tempo proporzionale al numero di utenti
+ * in attesa. Per gli altri stati la lista è un'istantanea: la struttura dell'albero è protetta in lettura, ma gli
+ * status sono letti senza acquisire i lock di riga.
  */
 
 char* getUserList_Mutex (status_t st)
 {
 	char* a = NULL;
-	ec_rv ( pthread_mutex_lock(&tree_mutex) )
-	a = getUserList(generalTree, st);
-	ec_rv ( pthread_mutex_unlock(&tree_mutex) )
+	if (st == WAITING) {	/* Gli utenti in attesa sono letti direttamente dalla lobby */
+		ec_rv ( pthread_mutex_lock(&lobby_mutex) )
+		a = getLobbyList(&usersDb);
+		ec_rv ( pthread_mutex_unlock(&lobby_mutex) )
+		return a;
+	}
+	ec_rv ( pthread_rwlock_rdlock(&tree_lock) )
+	a = getUserList(usersDb.root, st);
+	ec_rv ( pthread_rwlock_unlock(&tree_lock) )
 	return a;
 	
 	EC_CLEANUP_BGN
-		pthread_mutex_unlock(&tree_mutex);
+		pthread_mutex_unlock(&lobby_mutex);
+		pthread_rwlock_unlock(&tree_lock);
 		return NULL;
 	EC_CLEANUP_END
 }
 
+/** Inizializza lo stato di una partita: in modalità test il mazzo è quello generato da \c newMazzo_r(TRUE)
+ * (con i moduli oggetto dei docenti sono i mazzi di riferimento dei test), altrimenti è mischiato a partire
+ * dal seme della partita
+ * 
+ * \param game partita
+ * \param ngame numero progressivo della partita
+ * 
+ * \retval 0 se tutto ok
+ * \retval -1 se si è verificato un errore (setta \c errno)
+ */
+int NewGame(game_t* game, int ngame)
+{
+	mazzo_t* m = NULL;
+	
+	if (!t_option) {
+		gameInit(game, seed_base + ngame);
+		return 0;
+	}
+	if ((m = newMazzo_r(TRUE)) == NULL) return -1;
+	gameDeal(game, m);
+	freeMazzo(m);
+	return 0;
+}
+
+/** Riceve da un giocatore la carta giocata e la applica alla partita, rispondendo con un messaggio MSG_ERR
+ * finché la carta non è valida
+ * 
+ * \param game partita
+ * \param player giocatore di turno (0 o 1)
+ * \param fd file descriptor del giocatore
+ * \param rb buffer di ricezione del giocatore
+ * \param msg messaggio in cui viene memorizzata la carta accettata (il buffer va deallocato dal chiamante)
+ * 
+ * \retval 0 se tutto ok
+ * \retval -1 se si è verificato un errore (setta \c errno)
+ */
+int ReceiveCard(game_t* game, int player, int fd, rbuf_t* rb, message_t* msg)
+{
+	message_t reply;
+	
+	reply.buffer = NULL;
+	ec_neg1 ( receiveMessageBuf(rb, msg) )
+	while (gamePlay(game, player, stringToPacked(msg->buffer)) == -1) {
+		if (errno == ENOENT) {
+			ec_neg1 ( createMessage(&reply, MSG_ERR, NOT_IN_DECK) )
+		}
+		else if (errno == EINVAL) {
+			ec_neg1 ( createMessage(&reply, MSG_ERR, NOT_A_CARD) )
+		}
+		else EC_FAIL
+		ec_neg1 ( sendMessage(fd, &reply) )
+		free(msg->buffer);
+		msg->buffer = NULL;
+		free(reply.buffer);
+		reply.buffer = NULL;
+		ec_neg1 ( receiveMessageBuf(rb, msg) )
+	}
+	return 0;
+	
+	EC_CLEANUP_BGN
+		if (reply.buffer != NULL) free(reply.buffer);
+		return -1;
+	EC_CLEANUP_END
+}
+
 /** Funzione della partita
  * \param fd_p1 file descriptor del giocatore che ha richiesto la sfida
  * \param fd_p2 file descriptor del giocatore che aspettava la sfida
@@ -355,27 +833,36 @@ char* getUserList_Mutex (status_t st)
  * \retval 0 se la partita si conclude normalmente
  * \retval err se si verificano errori (intero compatibile con le specifiche di \c errno)
  * 
- * E' possibile trovare ulteriori informazioni sulla struttura della partita nella relazione
+ * E' possibile trovare ulteriori informazioni sulla struttura della partita nella relazione. Lo stato e le regole
+ * della partita sono gestiti dal modulo \c game (giocatore 0 lo sfidante, 1 lo sfidato): la funzione si occupa
+ * solo dello scambio dei messaggi e del file di log
  */
 
 int Play (int fd_p1, int fd_p2, char* player1, char* player2)
 {
-	int i, filename_len, fd_first, fd_second, check, P1Number = 0, P2Number = 0, points1, points2, err = 0, winsize;
-	bool_t whowins, finished = FALSE;
+	int i, filename_len, nbatch, lead, points1, points2, err = 0, winsize, ngame, fd[2];
 	FILE *log = NULL;
-	mazzo_t* deck = NULL;
-	carta_t* FirstPlayerHand[3], *SecondPlayerHand[3], *playedByFirst = NULL, *playedBySecond = NULL, *P1Cards[NCARTE], *P2Cards[NCARTE], *drawn1 = NULL, *drawn2 = NULL, *copia1 = NULL, *copia2 = NULL;
-	message_t toFirst, toSecond, fromFirst, fromSecond;
-	char* buffer1 = NULL, *buffer2 = NULL, cd[3], *first = NULL, *second = NULL, *filename = NULL, numb[5], winpoints[4], *winner = NULL, *winstring = NULL;
+	game_t game;
+	const trick_t* t = NULL;
+	message_t toFirst, toSecond, fromFirst, fromSecond, batch_a[2], batch_b[2];
+	rbuf_t *rb[2] = {NULL, NULL};
+	char* buffer1 = NULL, *buffer2 = NULL, cd[3], *name[2], *filename = NULL, numb[5], cardt[5], carda[5], winpoints[4], *winner = NULL, *winstring = NULL;
 	
 	toFirst.buffer = NULL;
 	toSecond.buffer = NULL;
 	fromSecond.buffer = NULL;
 	fromFirst.buffer = NULL;
+	fd[0] = fd_p1;
+	fd[1] = fd_p2;
+	name[0] = player1;
+	name[1] = player2;
+	
+	ec_null ( rb[0] = ClientBuffer(fd_p1) )
+	ec_null ( rb[1] = ClientBuffer(fd_p2) )
 	
 	/* Creazione del file di log (con il nome corretto) */
 	ec_rv ( err = pthread_mutex_lock(&plays_mutex) )
-	npart++;
+	ngame = ++npart;
 	sprintf(numb, "%d", npart);
 	ec_rv ( err = pthread_mutex_unlock(&plays_mutex) )
 	filename_len = strlen(LOG_NAME_ST) + strlen(LOG_NAME_END) + strlen(numb) + 1;
@@ -387,23 +874,22 @@ int Play (int fd_p1, int fd_p2, char* player1, char* player2)
 	free(filename);
 	filename = NULL;
 	
-	/* Generazione del mazzo */
-	ec_null ( deck = newMazzo_r(t_option) )
-	fprintf(log, FIRST_LOG, player1, player2, semeToChar(deck->briscola));
+	/* Inizializzazione della partita */
+	ec_neg1 ( NewGame(&game, ngame) )
+	fprintf(log, FIRST_LOG, player1, player2, semeToChar(game.deck.briscola));
+	if (!t_option) fprintf(log, SEED_LOG, (unsigned long long)(seed_base + ngame));
 	
-	/* Generazione delle mani, preparazione ed invio dei messaggi MSG_STARTGAME */
+	/* Preparazione ed invio dei messaggi MSG_STARTGAME */
 	toFirst.length = 10+strlen(player2);
 	toSecond.length = 10+strlen(player1);
 	ec_null ( buffer1 = (char*)malloc((toFirst.length)*sizeof(char)) )
 	ec_null ( buffer2 = (char*)malloc((toSecond.length)*sizeof(char)) )
-	buffer1[0] = semeToChar(deck->briscola); buffer1[1] = ':'; buffer1[2] = '\0'; 
-	buffer2[0] = semeToChar(deck->briscola); buffer2[1] = ':'; buffer2[2] = '\0';
+	buffer1[0] = semeToChar(game.deck.briscola); buffer1[1] = ':'; buffer1[2] = '\0'; 
+	buffer2[0] = semeToChar(game.deck.briscola); buffer2[1] = ':'; buffer2[2] = '\0';
 	for (i = 0; i < 3; i++) {
-		FirstPlayerHand[i] = getCard(deck);
-		cardToString(cd, FirstPlayerHand[i]);
+		packedToString(cd, game.dealt[0][i]);
 		strcat(buffer1, cd);
-		SecondPlayerHand[i] = getCard(deck);
-		cardToString(cd, SecondPlayerHand[i]);
+		packedToString(cd, game.dealt[1][i]);
 		strcat(buffer2, cd);
 	}
 	strcat(buffer1, ":"); strcat(buffer1, player2);
@@ -421,193 +907,63 @@ int Play (int fd_p1, int fd_p2, char* player1, char* player2)
 	toFirst.buffer = NULL;
 	toSecond.buffer = NULL;
 	
-	/* Assegnazione iniziale dell'ordine dei turni */
-	first = player1;
-	second = player2;
-	fd_first = fd_p1;
-	fd_second = fd_p2;
-	
 	/* Ciclo principale */
-	while (!finished) {
+	while (!gameIsOver(&game)) {
 		
-		/* Ricezione della carta giocata dal primo */
-		ec_neg1 ( receiveMessage(fd_first, &fromFirst) )
-		playedByFirst = stringToCard(fromFirst.buffer);
-		if (playedByFirst == NULL)
-			if (errno == EINVAL) check = -1;
-			else {
-				err = errno;
-				return err;
-			}
-		else check = isInHand(playedByFirst, FirstPlayerHand);
-		
-		/* Controllo sulla validità della carta giocata */
-		while (check != 1) {
-			if (check == 0) {
-				ec_neg1 ( createMessage(&toFirst, MSG_ERR, NOT_IN_DECK) )
-			}
-			if (check == -1) {
-				ec_neg1 ( createMessage(&toFirst, MSG_ERR, NOT_A_CARD) )
-			}
-			ec_neg1 ( sendMessage(fd_first, &toFirst) )
-			free(fromFirst.buffer);
-			fromFirst.buffer = NULL;
-			free(toFirst.buffer);
-			toFirst.buffer = NULL;
-			ec_neg1 ( receiveMessage(fd_first, &fromFirst) )
-			playedByFirst = stringToCard(fromFirst.buffer);
-			if (playedByFirst == NULL)
-				if (errno == EINVAL) check = -1;
-				else {
-					err = errno;
-					return err;
-				}
-			else check = isInHand(playedByFirst, FirstPlayerHand);
-		}
+		/* Ricezione della carta giocata dal giocatore di mano */
+		lead = gameTurn(&game);
+		ec_neg1 ( ReceiveCard(&game, lead, fd[lead], rb[lead], &fromFirst) )
 		
 		/* Invio delle informazioni al secondo e ricezione della sua carta */
 		ec_neg1 ( createMessage(&toSecond, MSG_PLAY, fromFirst.buffer) )
-		ec_neg1 ( sendMessage(fd_second, &toSecond) )
+		ec_neg1 ( sendMessage(fd[1-lead], &toSecond) )
 		free(toSecond.buffer);
 		toSecond.buffer = NULL;
+		ec_neg1 ( ReceiveCard(&game, 1-lead, fd[1-lead], rb[1-lead], &fromSecond) )
 		
-		ec_neg1 ( receiveMessage(fd_second, &fromSecond) )
-		playedBySecond = stringToCard(fromSecond.buffer);
-		if (playedBySecond == NULL) 
-			if (errno == EINVAL) check = -1;
-			else {
-				err = errno;
-				return err;
-			}
-		else check = isInHand(playedBySecond, SecondPlayerHand);
+		/* Fine del turno: le risposte ai due giocatori sono inviate dopo la pesca, insieme ai messaggi MSG_CARD */
+		fprintf(log, "%s:%s#%s:%s\n", name[lead], fromFirst.buffer, name[1-lead], fromSecond.buffer);
+		t = gameTrickResult(&game);
 		
-		/* Controllo sulla validità della carta giocata */
-		while (check != 1) {
-			if (check == 0) {
-				ec_neg1 ( createMessage(&toSecond, MSG_ERR, NOT_IN_DECK) )
-			}
-			if (check == -1) {
-				ec_neg1 ( createMessage(&toSecond, MSG_ERR, NOT_A_CARD) )
-			}
-			ec_neg1 ( sendMessage(fd_second, &toSecond) )
-			free(fromSecond.buffer);
-			fromSecond.buffer = NULL;
-			free(toSecond.buffer);
-			toSecond.buffer = NULL;
-			ec_neg1 ( receiveMessage(fd_second, &fromSecond) )
-			playedBySecond = stringToCard(fromSecond.buffer);
-			if (playedBySecond == NULL)
-				if (errno == EINVAL) check = -1;
-				else {
-					err = errno;
-					return err;
-				}
-			else check = isInHand(playedBySecond, SecondPlayerHand);
+		/* Composizione dei messaggi di fine turno: MSG_PLAY per chi ha giocato per primo, MSG_OK per l'altro
+		 * e, se la partita non è ancora finita, i messaggi MSG_CARD (un'unica writev per ciascun giocatore) */
+		batch_a[0].type = MSG_PLAY;
+		batch_a[0].length = fromSecond.length;
+		batch_a[0].buffer = fromSecond.buffer;
+		batch_b[0].type = MSG_OK;
+		batch_b[0].length = 0;
+		batch_b[0].buffer = NULL;
+		nbatch = 1;
+		if (!gameIsOver(&game)) {
+			if (t->drawn[t->winner] != NOCARD) packedToString(cd, t->drawn[t->winner]);
+			else strcpy(cd, "NN");
+			sprintf(cardt, "t:%s", cd);
+			
+			if (t->drawn[1-t->winner] != NOCARD) packedToString(cd, t->drawn[1-t->winner]);
+			else strcpy(cd, "NN");
+			sprintf(carda, "a:%s", cd);
+			
+			/* Il vincitore del turno (nuovo primo di mano) riceve la carta "t", l'altro la carta "a" */
+			batch_a[1].type = MSG_CARD;
+			batch_a[1].length = strlen(cardt)+1;
+			batch_a[1].buffer = (t->winner == lead) ? cardt : carda;
+			batch_b[1].type = MSG_CARD;
+			batch_b[1].length = strlen(carda)+1;
+			batch_b[1].buffer = (t->winner == lead) ? carda : cardt;
+			nbatch = 2;
 		}
+		ec_neg1 ( sendMessages(fd[lead], batch_a, nbatch) )
+		ec_neg1 ( sendMessages(fd[1-lead], batch_b, nbatch) )
 		
-		ec_neg1 ( createMessage(&toSecond, MSG_OK, NULL) )
-		ec_neg1 ( sendMessage(fd_second, &toSecond) )
-		
-		ec_neg1 ( createMessage(&toFirst, MSG_PLAY, fromSecond.buffer) )
-		ec_neg1 ( sendMessage(fd_first, &toFirst) )
-		free(toFirst.buffer);
-		toFirst.buffer = NULL;
-		
-		/* Fine del turno */
-		fprintf(log, "%s:%s#%s:%s\n", first, fromFirst.buffer, second, fromSecond.buffer);
 		free(fromFirst.buffer);
 		fromFirst.buffer = NULL;
 		free(fromSecond.buffer);
 		fromSecond.buffer = NULL;
-		
-		ec_null ( copia1 = (carta_t*)malloc(sizeof(carta_t)) )
-		ec_null ( copia2 = (carta_t*)malloc(sizeof(carta_t)) )
-		copia1->seme = playedByFirst->seme;
-		copia1->val = playedByFirst->val;
-		copia2->seme = playedBySecond->seme;
-		copia2->val = playedBySecond->val;
-		
-		whowins = compareCard(deck->briscola, playedByFirst, playedBySecond);
-		if (whowins) {
-			if (strcmp(player1, first) == 0) {
-				P1Cards[P1Number] = copia1;
-				P1Number++;
-				P1Cards[P1Number] = copia2;
-				P1Number++;
-			}
-			else {
-				P2Cards[P2Number] = copia1;
-				P2Number++;
-				P2Cards[P2Number] = copia2;
-				P2Number++;
-			}
-		}
-		else {
-			if (strcmp(player1, first) == 0) {
-				P2Cards[P2Number] = copia1;
-				P2Number++;
-				P2Cards[P2Number] = copia2;
-				P2Number++;
-				first = player2;
-				second = player1;
-				ec_neg1 ( exchangeHands(FirstPlayerHand, SecondPlayerHand) )
-				fd_first = fd_p2;
-				fd_second = fd_p1;
-			}
-			else {
-				P1Cards[P1Number] = copia1;
-				P1Number++;
-				P1Cards[P1Number] = copia2;
-				P1Number++;
-				first = player1;
-				second = player2;
-				ec_neg1 ( exchangeHands(FirstPlayerHand, SecondPlayerHand) )
-				fd_first = fd_p1;
-				fd_second = fd_p2;
-			}
-			
-		}
-		
-		/* Pesca nuove carte dal mazzo */
-		if ((drawn1 = getCard(deck)) == NULL) {
-			if (errno != 0) EC_CLEANUP_NOW
-		}
-		if (whowins) replace(FirstPlayerHand, drawn1, playedByFirst);
-		else replace(FirstPlayerHand, drawn1, playedBySecond);
-		
-		if ((drawn2 = getCard(deck)) == NULL) {
-			if (errno != 0) EC_CLEANUP_NOW
-		}
-		if (whowins) replace(SecondPlayerHand, drawn2, playedBySecond);
-		else replace (SecondPlayerHand, drawn2, playedByFirst);
-		
-		finished = checkIfFinish(FirstPlayerHand, SecondPlayerHand);
-		
-		/* Se la partita non è ancora finita: composizione e invio dei messaggi MSG_CARD */
-		if (!finished) {
-			if (drawn1 != NULL) cardToString(cd, drawn1);
-			else strcpy(cd, "NN");
-			sprintf(numb, "t:%s", cd);
-			ec_neg1 ( createMessage(&toFirst, MSG_CARD, numb) )
-			ec_neg1 ( sendMessage(fd_first, &toFirst) )
-			free(toFirst.buffer);
-			toFirst.buffer = NULL;
-			if (drawn1 != NULL) free(drawn1);
-			
-			if (drawn2 != NULL) cardToString(cd, drawn2);
-			else strcpy(cd, "NN");
-			sprintf(numb, "a:%s", cd);
-			ec_neg1 ( createMessage(&toSecond, MSG_CARD, numb) )
-			ec_neg1 ( sendMessage(fd_second, &toSecond) )
-			free(toSecond.buffer);
-			toSecond.buffer = NULL;
-			if (drawn2 != NULL) free(drawn2);
-		}
 	}
 	
 	/* Fine partita: conteggio punti e decretazione vincitore */
-	points1 = computePoints(P1Cards, P1Number);
-	points2 = computePoints(P2Cards, P2Number);
+	points1 = gameScore(&game, 0);
+	points2 = gameScore(&game, 1);
 	if (points1 > points2) {
 		winner = player1;
 		sprintf(winpoints, "%d", points1);
@@ -638,19 +994,6 @@ int Play (int fd_p1, int fd_p2, char* player1, char* player2)
 	ec_neg1 ( sendMessage(fd_p2, &toFirst) )
 	
 	/* Operazioni finali di pulizia */
-	for (i = 0; i < P1Number; i++) {
-		if (P1Cards[i] != NULL) {
-			free(P1Cards[i]);
-			P1Cards[i] = NULL;
-		}
-	}
-	for (i = 0; i < P2Number; i++) {
-		if (P2Cards[i] != NULL) {
-			free(P2Cards[i]);
-			P2Cards[i] = NULL;
-		}
-	}
-	freeMazzo(deck);
 	free(toFirst.buffer);
 	toFirst.buffer = NULL;
 	free(winstring);
@@ -660,16 +1003,12 @@ int Play (int fd_p1, int fd_p2, char* player1, char* player2)
 	
 	EC_CLEANUP_BGN
 		if (err == 0) err = errno;
-		closeConnection(fd_p1);
-		closeConnection(fd_p2);
-		
-		freeMazzo(deck);
+		CloseClient(fd_p1);
+		CloseClient(fd_p2);
 		
 		if (filename != NULL) free(filename);
 		if (buffer1 != NULL) free(buffer1);
 		if (buffer2 != NULL) free(buffer2);
-		if (playedByFirst != NULL) free(playedByFirst);
-		if (playedBySecond != NULL) free(playedBySecond);
 		if (fromFirst.buffer != NULL) free(fromFirst.buffer);
 		if (toFirst.buffer != NULL) free(toFirst.buffer);
 		if (fromSecond.buffer != NULL) free(fromSecond.buffer);
@@ -678,28 +1017,6 @@ int Play (int fd_p1, int fd_p2, char* player1, char* player2)
 			if(strcmp(winner, DRAW) == 0) free(winner);
 		if (winstring != NULL) free(winstring);
 		
-		if (drawn1 != NULL) free(drawn1);
-		if (drawn2 != NULL) free(drawn2);
-		if (copia1 != NULL) free(copia1);
-		if (copia2 != NULL) free(copia2);
-		for (i = 0; i < P1Number; i++) {
-			if (P1Cards[i] != NULL) {
-				free(P1Cards[i]);
-				P1Cards[i] = NULL;
-			}
-		}
-		for (i = 0; i < P2Number; i++) {
-			if (P2Cards[i] != NULL) {
-				free(P2Cards[i]);
-				P2Cards[i] = NULL;
-			}
-		}
-		
-		for (i = 0; i < 3; i++) {
-			if (FirstPlayerHand[i] != NULL) free(FirstPlayerHand[i]);
-			if (SecondPlayerHand[i] != NULL) free(SecondPlayerHand[i]);
-		}
-		
 		setUserStatus_Mutex(player1, DISCONNECTED);
 		setUserChannel_Mutex(player1, -1);
 		setUserStatus_Mutex(player2, DISCONNECTED);
@@ -712,34 +1029,107 @@ int Play (int fd_p1, int fd_p2, char* player1, char* player2)
 	EC_CLEANUP_END
 }
 
-/** Funzione del thread di gestione dei segnali
+/** Scrittura del checkpoint nel processo figlio creato da \c StartCheckpoint (non ritorna)
  * 
- * \param arg thread_id del thread Dispatcher (castato a \c void*)
+ * \section commagg11 Commenti Aggiuntivi
+ * Il figlio dispone di una copia (copy-on-write) della memoria del server al momento della \c fork, presa con il lock
+ * dell'albero in lettura: l'albero che visita è quindi consistente e non viene più modificato, qualunque cosa facciano
+ * nel frattempo i thread del server. Il file viene scritto con un nome temporaneo, sincronizzato su disco e rinominato
+ * solo se completo, per cui \c CP_NAME contiene sempre un checkpoint intero. Nel figlio esiste il solo thread chiamante:
+ * per non dipendere da lock presi da altri thread al momento della \c fork, il messaggio finale è scritto con la \c write.
+ */
+void WriteCheckpoint(void)
+{
+	FILE* out = NULL;
+	bool_t ok = FALSE;
+	if ((out = fopen(CP_TMP, "w")) != NULL) {
+		ok = (storeUsers(out, usersDb.root) != -1 && fflush(out) != EOF && fsync(fileno(out)) != -1);
+		ok = (fclose(out) != EOF) && ok;
+		ok = ok && (rename(CP_TMP, CP_NAME) != -1);
+		if (!ok) unlink(CP_TMP);
+	}
+	if (ok) (void) write(STDERR_FILENO, CHECK_SIGUSR1 "\n", strlen(CHECK_SIGUSR1 "\n"));
+	_exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/** Attende la terminazione del processo che scrive il checkpoint (se esiste), segnalando se la scrittura è fallita
  * 
- * \retval 0 in caso di terminazione con successo
- * \retval err in caso di errore
+ * \param block TRUE per attendere la terminazione, FALSE per raccogliere il processo solo se è già terminato
  * 
- * \section commagg2 Commenti Aggiuntivi
- * Il thread è deputato alla ricezione di segnali SIGINT, SIGTERM e SIGUSR1. La ricezione è effettuata mediante la SC \c sigwait,
- * posta in un ciclo controllato dalla variabile globale di terminazione \c term_signal. Il segnale SIGUSR1 provoca la stampa dell'albero
- * corrente nel file di checkpoint, operazione effettuata da questo stesso thread; i segnali SIGINT e SIGTERM pongono \c term_signal a 1
- * e cancellano il thread \c Dispatcher (che, prima di terminare, eseguirà la funzione di cleanup \c joinAllThreads).
+ * \retval 0 se tutto ok
+ * \retval -1 se si è verificato un errore (setta \c errno)
  */
-void* Signaler(void* arg) 
+int WaitCheckpoint(bool_t block)
 {
-	int snumb;
-	pthread_t *from_arg, dispatch;
-	FILE * out = NULL;
-	sigset_t sgs;
-	from_arg = (pthread_t*) arg;
-	dispatch = *from_arg;
+	int st = 0;
+	pid_t pid;
+	if (cp_child == 0) return 0;
+	ec_neg1 ( pid = waitpid(cp_child, &st, block ? 0 : WNOHANG) )
+	if (pid == 0) return 0;		/* Ancora in scrittura */
+	cp_child = 0;
+	if (!WIFEXITED(st) || WEXITSTATUS(st) != EXIT_SUCCESS) fprintf(stderr, "%s\n", CHECK_FAILED);
+	return 0;
 	
-	/* Impostazione della maschera per i segnali (1 per SIGINT, SIGTERM e SIGUSR1, 0 per gli altri)
+	EC_CLEANUP_BGN
+		return -1;
+	EC_CLEANUP_END
+}
+
+/** Avvia la scrittura del checkpoint in un processo figlio (\c WriteCheckpoint): il lock dell'albero è tenuto
+ * solo per la durata della \c fork, indipendentemente dal numero di utenti
+ * 
+ * \retval 0 se tutto ok
+ * \retval -1 se si è verificato un errore (setta \c errno)
+ */
+int StartCheckpoint(void)
+{
+	pid_t pid;
+	int err = 0;
+	/* Un solo checkpoint alla volta: il precedente, se ancora in scrittura, usa lo stesso file temporaneo */
+	ec_neg1 ( WaitCheckpoint(TRUE) )
+	ec_rv ( pthread_rwlock_rdlock(&tree_lock) )
+	if ((pid = fork()) == 0) WriteCheckpoint();
+	err = errno;
+	ec_rv ( pthread_rwlock_unlock(&tree_lock) )
+	errno = err;
+	ec_neg1 ( pid )
+	cp_child = pid;
+	return 0;
+	
+	EC_CLEANUP_BGN
+		return -1;
+	EC_CLEANUP_END
+}
+
+/** Funzione del thread di gestione dei segnali
+ * 
+ * \param arg thread_id del thread Dispatcher (castato a \c void*)
+ * 
+ * \retval 0 in caso di terminazione con successo
+ * \retval err in caso di errore
+ * 
+ * \section commagg2 Commenti Aggiuntivi
+ * Il thread è deputato alla ricezione di segnali SIGINT, SIGTERM, SIGUSR1 e SIGCHLD. La ricezione è effettuata mediante la SC \c sigwait,
+ * posta in un ciclo controllato dalla variabile globale di terminazione \c term_signal. Il segnale SIGUSR1 provoca la stampa dell'albero
+ * corrente nel file di checkpoint, affidata ad un processo figlio (\c StartCheckpoint) di cui SIGCHLD segnala la terminazione;
+ * i segnali SIGINT e SIGTERM pongono \c term_signal a 1 e cancellano il thread \c Dispatcher (che, prima di terminare, eseguirà
+ * la funzione di cleanup \c waitAllThreads). Prima di terminare, il thread attende l'eventuale checkpoint ancora in scrittura.
+ */
+void* Signaler(void* arg) 
+{
+	int snumb;
+	pthread_t *from_arg, dispatch;
+	sigset_t sgs;
+	from_arg = (pthread_t*) arg;
+	dispatch = *from_arg;
+	
+	/* Impostazione della maschera per i segnali (1 per SIGINT, SIGTERM, SIGUSR1 e SIGCHLD, 0 per gli altri)
 	 * ed applicazione al thread corrente */
 	ec_neg1 ( sigemptyset(&sgs) )
 	ec_neg1 ( sigaddset(&sgs, SIGINT) )
 	ec_neg1 ( sigaddset(&sgs, SIGTERM) )
 	ec_neg1 ( sigaddset(&sgs, SIGUSR1) )
+	ec_neg1 ( sigaddset(&sgs, SIGCHLD) )
 	ec_rv ( pthread_sigmask(SIG_SETMASK, &sgs, NULL) )
 
 	while (!CheckTermSignal()) {
@@ -755,23 +1145,23 @@ void* Signaler(void* arg)
 				(void) WriteTermSignal();
 				ec_rv ( pthread_cancel(dispatch) )
 				break;
-			case SIGUSR1:	/* SIGUSR1: stampa l'albero attuale, non termina */
-				ec_null ( out = fopen(CP_NAME, "w") )
-				ec_rv ( pthread_mutex_lock(&tree_mutex) )
-				ec_neg1 ( storeUsers(out, generalTree) )
-				ec_rv ( pthread_mutex_unlock(&tree_mutex) )
-				ec_eof ( fclose(out) )
-				out = NULL;
-				fprintf(stderr, "%s\n", CHECK_SIGUSR1);
+			case SIGUSR1:	/* SIGUSR1: stampa l'albero attuale (in un processo figlio), non termina */
+				ec_neg1 ( StartCheckpoint() )
+				ec_rv ( pthread_mutex_lock(&lobby_mutex) )
+				fprintf(stderr, CACHE_STATS, cache_hits, cache_misses);
+				ec_rv ( pthread_mutex_unlock(&lobby_mutex) )
+				break;
+			case SIGCHLD:	/* SIGCHLD: terminazione del processo che scrive il checkpoint */
+				ec_neg1 ( WaitCheckpoint(FALSE) )
 				break;
 		}
 	}
+	ec_neg1 ( WaitCheckpoint(TRUE) )
 	return NULL;
 	
 	EC_CLEANUP_BGN
 	
-		pthread_mutex_unlock(&tree_mutex);
-		if (out != NULL) fclose(out);
+		pthread_mutex_unlock(&lobby_mutex);
 		return NULL;
 	
 	EC_CLEANUP_END
@@ -810,7 +1200,7 @@ message_t* User_Register(char* buf)
 					return NULL;
 				}
 				break;
-			case 0:		/* addUser eseguita con successo; *NON* dealloco client_user perché entra a far parte dell'albero! */
+			case 0:		/* addUser eseguita con successo; client_user è stato copiato nel nodo e deallocato da addUser */
 				if (createMessage(retn, MSG_OK, NULL) == -1) {
 					free(retn);
 					return NULL;
@@ -864,6 +1254,12 @@ message_t* User_Cancel(char* buf)
 					return NULL;
 				}
 				break;
+			case ALRCONN:	/* removeUser non eseguita, l'utente è connesso */
+				if (createMessage(retn, MSG_NO, ALR_CONN) == -1) {
+					free(retn);
+					return NULL;
+				}
+				break;
 			case -1:	/* removeUser fallita */
 				if (createMessage(retn, MSG_ERR, REMOVE_ERROR) == -1) {
 					free(retn);
@@ -936,23 +1332,79 @@ message_t* User_Disconnect(char* buf)
 	return retn;
 }
 
+/** Dimensione massima di una pagina della lista degli utenti in attesa (richiesta con \c MSG_LOBBY) */
+#define MAXPAGE 100
+
+/** Estrae i parametri della pagina da una richiesta \c MSG_LOBBY
+ * 
+ * \param buf richiesta in formato \c offset:n_utenti:prefisso:username:password
+ * \param offset puntatore in cui viene memorizzato il numero di utenti da saltare
+ * \param limit puntatore in cui viene memorizzato il numero di utenti della pagina (al più \c MAXPAGE)
+ * \param prefix buffer (di almeno <tt>LUSER+1</tt> caratteri) in cui viene memorizzato il prefisso
+ * 
+ * \retval p puntatore alle credenziali (\c username:password ) all'interno di \c buf
+ * \retval NULL se la richiesta non è nel formato corretto
+ */
+char* ParsePage(char* buf, unsigned int* offset, unsigned int* limit, char* prefix)
+{
+	char *p = buf, *end = NULL;
+	long n;
+	errno = 0;
+	n = strtol(p, &end, 10);
+	if (end == p || *end != ':' || n < 0 || n > INT_MAX || errno != 0) return NULL;
+	(*offset) = n;
+	p = end+1;
+	n = strtol(p, &end, 10);
+	if (end == p || *end != ':' || n <= 0 || errno != 0) return NULL;
+	(*limit) = (n > MAXPAGE) ? MAXPAGE : n;
+	p = end+1;
+	if ((end = strchr(p, ':')) == NULL || end-p > LUSER) return NULL;
+	strncpy(prefix, p, end-p);
+	prefix[end-p] = '\0';
+	return end+1;
+}
+
 /** Inizializzazione della connessione (thread Worker): controllo credenziali, ricezione lista utenti connessi,
  * preparazione del messaggio
  * 
- * \param buf buffer contenente le credenziali dell'utente in formato \c username:password
+ * \param buf buffer contenente le credenziali dell'utente in formato \c username:password (preceduto dai parametri
+ * della pagina, nel formato di \c ParsePage, se \c paged == \c TRUE )
+ * \param paged \c TRUE se il client ha richiesto una pagina della lista degli utenti in attesa ( \c MSG_LOBBY )
  * \param player buffer che conterrà il nome dell'utente
  * \param sock file descriptor della socket del client
+ * \param handle puntatore in cui viene memorizzato il nodo dell'utente, se la connessione va a buon fine
+ * (altrimenti viene posto a \c NULL )
  * 
  * \retval retn struttura messaggio di risposta
  * 
+ * \section commagg7 Commenti Aggiuntivi
+ * Il nodo dell'utente viene cercato una sola volta; lettura della lobby, controllo della password, controllo dello
+ * stato e impostazione di stato e canale sono eseguiti con un'unica acquisizione dei lock. Se non ci sono utenti in
+ * attesa, il client viene messo direttamente nello stato \c WAITING. Con \c MSG_LOBBY la lista contiene solo
+ * la pagina richiesta, calcolata sull'albero della lobby in tempo proporzionale alla dimensione della pagina
+ * (che può anche essere vuota, se nessun utente in attesa corrisponde alla richiesta); la lista completa è invece
+ * quella condivisa restituita da \c LobbyPayload, ricostruita solo se la lobby è cambiata.
  */
-message_t* User_Setup(char* buf, char* player, int sock)
+message_t* User_Setup(char* buf, bool_t paged, char* player, int sock, nodo_t** handle)
 {
-	int msglen;
-	char* player_list = NULL;
+	int msglen, esito = NOUSR, nlist = 0;
+	unsigned int s, offset = 0, limit = 0;
+	bool_t empty = TRUE;
+	char prefix[LUSER+1];
+	lobbycache_t* lc = NULL;
+	listbuf_t* lb = NULL;
 	message_t* retn = NULL;
 	user_t* client_user;
+	nodo_t* h = NULL;
+	(*handle) = NULL;
 	if ((retn = (message_t*)malloc(sizeof(message_t))) == NULL) return NULL;
+	if (paged && (buf = ParsePage(buf, &offset, &limit, prefix)) == NULL) {
+		if (createMessage(retn, MSG_ERR, PAGE_ERR) == -1) {
+			free(retn);
+			return NULL;
+		}		/* Comunico al client che la richiesta della pagina non è valida */
+		return retn;
+	}
 	msglen = strlen(buf)+1;
 	client_user = stringToUser(buf, msglen);
 	if (client_user == NULL) {
@@ -960,92 +1412,91 @@ message_t* User_Setup(char* buf, char* player, int sock)
 			free(retn);
 			return NULL;
 		}		/* Comunico al client che la stringToUser è fallita */
+		return retn;
 	}
-	else {
-		strcpy(player, client_user->name);
-		if (isUser_Mutex(client_user->name)) { /* Controllo credenziali */
-			if (checkPwd_Mutex(client_user)) {
-				status_t check;
-				check = getUserStatus_Mutex(client_user->name);
-				if (check == WAITING || check == PLAYING) { /* Utente già connesso */
-					if (createMessage(retn, MSG_ERR, ALR_CONN) == -1) {
-						free(client_user);
-						free(retn);
-						return NULL;
-					}
-				}
-				else {
-					player_list = getUserList_Mutex(WAITING);
-					if (player_list == NULL && errno == 0) {  /* Nessun utente in attesa */
-						if (createMessage(retn, MSG_WAIT, NULL) == -1) {
-							free(client_user);
-							free(retn);
-							return NULL;
-						}
-						setUserStatus_Mutex(client_user->name, WAITING);
-						setUserChannel_Mutex(client_user->name, sock);
-					}
-					else if (player_list == NULL && errno != 0) {
-						free(client_user);
-						return NULL;
-					}					
-					else {
-						if (createMessage(retn, MSG_OK, player_list) == -1) {
-							free(client_user);
-							free(retn);
-							free(player_list);
-							return NULL;
-						}
-						free(player_list);
-					}
-				}
-			}
-			else {
-				if (createMessage(retn, MSG_NO, WRPWD_ERROR) == -1) {
-					free(client_user);
-					free(retn);
-					return NULL;
-				}
-			}
-		}
-		else {
-			if (createMessage(retn, MSG_NO, NOUSR_ERROR) == -1) {
-				free(client_user);
-				free(retn);
-				return NULL;
-			}
-		}
+	strcpy(player, client_user->name);
+	s = StripeOf(client_user->name);
+	if ((lb = ListBuffer()) == NULL) {
+		free(client_user);
+		free(retn);
+		return NULL;
+	}
+	
+	/* Ricerca dell'utente, lista degli utenti in attesa e connessione con un'unica acquisizione dei lock */
+	if ((errno = pthread_rwlock_rdlock(&tree_lock)) != 0) {
+		free(client_user);
+		free(retn);
+		return NULL;
 	}
+	if ((h = findUserDb(&usersDb, client_user->name)) != NULL) {
+		pthread_mutex_lock(&user_stripe[s]);
+		pthread_mutex_lock(&lobby_mutex);
+		empty = (usersDb.nlobby == 0);
+		if (paged) nlist = getLobbyPage(&usersDb, prefix, offset, limit, &(lb->buf), &(lb->size));
+		else if (!empty) nlist = ((lc = LobbyPayload()) == NULL) ? -1 : 1;
+		else nlist = 0;
+		if (nlist != -1) esito = connectUser(&usersDb, h, client_user, empty ? WAITING : DISCONNECTED, sock);
+		else esito = -1;
+		pthread_mutex_unlock(&lobby_mutex);
+		pthread_mutex_unlock(&user_stripe[s]);
+	}
+	pthread_rwlock_unlock(&tree_lock);
 	free(client_user);
+	
+	switch (esito) {
+		case 0:
+			(*handle) = h;
+			if (empty) msglen = createMessage(retn, MSG_WAIT, NULL);	/* Nessun utente in attesa */
+			else if (lc != NULL) msglen = createMessage(retn, MSG_OK, lc->payload);
+			else msglen = createMessage(retn, MSG_OK, (nlist == 0) ? "" : lb->buf);
+			break;
+		case NOUSR:
+			msglen = createMessage(retn, MSG_NO, NOUSR_ERROR);
+			break;
+		case WRPWD:
+			msglen = createMessage(retn, MSG_NO, WRPWD_ERROR);
+			break;
+		case ALRCONN:	/* Utente già connesso */
+			msglen = createMessage(retn, MSG_ERR, ALR_CONN);
+			break;
+		default:
+			msglen = -1;
+			break;
+	}
+	if (lc != NULL) ReleasePayload(lc);
+	if (msglen == -1) {
+		if ((*handle) != NULL) releaseUser_Mutex(h, sock);
+		(*handle) = NULL;
+		free(retn);
+		return NULL;
+	}
 	return retn;
 }
 
-/** Funzione del thread di connessione al client
+/** Gestione di una connessione con un client (thread Worker o thread del pool)
  * 
- * \param arg puntatore al file descriptor della socket di connessione
- * 
- * \retval NULL
+ * \param sock file descriptor della socket di connessione
  * 
  * \section commagg3 Commenti Aggiuntivi
- * Il thread gestisce le operazioni richieste dal client mediante una serie di invii e ricezioni di messaggi.
+ * La funzione gestisce le operazioni richieste dal client mediante una serie di invii e ricezioni di messaggi.
  * Ogni operazione chiama un'apposita funzione di gestione, che elabora le informazioni richieste e prepara
- * la risposta al client; se il client richiede di iniziare una partita, il thread chiama la funzione Play.
+ * la risposta al client; se il client richiede di iniziare una partita, viene chiamata la funzione Play.
  * Maggiori informazioni sono disponibili nella relazione.
  */
 
-void* Worker(void* arg)
+void ServeClient(int sock)
 {
-	int *sock_p, sock, guest_sock;
+	int guest_sock = -1, chan = sock;
 	bool_t playing = FALSE, waiting = FALSE;
 	message_t *receive = NULL, *send = NULL;
+	rbuf_t *rb = NULL;
+	nodo_t *handle = NULL, *guest_handle = NULL;
 	char player[LUSER+1], guest[LUSER+1];
-	sock_p = (int*) arg;
-	sock = *sock_p;
-	free(arg);
+	ec_null ( rb = OpenClient(sock) )
 	ec_null ( receive = (message_t*)malloc(sizeof(message_t)) )
 		
 	/* Ricezione del primo messaggio */
-	ec_neg1 ( receiveMessage(sock, receive) )		
+	ec_neg1 ( receiveMessageBuf(rb, receive) )		
 		
 	switch (receive->type) {
 		case MSG_REG:
@@ -1058,18 +1509,12 @@ void* Worker(void* arg)
 			ec_null ( send = User_Disconnect(receive->buffer) )		/* Disconnessione forzata */
 			break;
 		case MSG_CONNECT:
-			ec_null ( send = User_Setup(receive->buffer, player, sock) )	/* Elaborazione richiesta di connessione */
-			if (send->type == MSG_OK) {		/* Connessione andata a buon fine, si può scegliere uno sfidante */
-				playing = TRUE;
-				setUserChannel_Mutex(player, sock);
-			}
-			else {
-				if (send->type == MSG_WAIT) {	/* Connessione andata a buon fine, nessuno sfidante disponibile */
-					waiting = TRUE;
-					setUserStatus_Mutex(player, WAITING);
-					setUserChannel_Mutex(player, sock);
-				}
-			}	/* Se la connessione non va a buon fine (errori o utente/psw errati) non devo fare nulla, messaggio già formato */
+		case MSG_LOBBY:
+			/* Elaborazione richiesta di connessione (stato e canale dell'utente sono già impostati) */
+			ec_null ( send = User_Setup(receive->buffer, receive->type == MSG_LOBBY, player, sock, &handle) )
+			if (send->type == MSG_OK) playing = TRUE;	/* Connessione andata a buon fine, si può scegliere uno sfidante */
+			else if (send->type == MSG_WAIT) waiting = TRUE;	/* Connessione andata a buon fine, nessuno sfidante disponibile */
+			/* Se la connessione non va a buon fine (errori o utente/psw errati) non devo fare nulla, messaggio già formato */
 			break;
 		default:
 			ec_neg1 ( createMessage(send, MSG_ERR, NOT_SUPPORTED) )
@@ -1085,29 +1530,31 @@ void* Worker(void* arg)
 		if (send->buffer != NULL) free(send->buffer);
 		receive->buffer = NULL;
 		send->buffer = NULL;
-		ec_neg1 ( receiveMessage(sock, receive) )
+		ec_neg1 ( receiveMessageBuf(rb, receive) )
 		
 		switch (receive->type) {
 			case MSG_WAIT:			/* Il client ha deciso di aspettare */
-				setUserStatus_Mutex(player, WAITING);
+				updateUser_Mutex(handle, WAITING, sock);
+				waiting = TRUE;
 				ec_neg1 ( createMessage(send, MSG_OK, NULL) )
 				ec_neg1 ( sendMessage(sock, send) )
-				waiting = TRUE;
 				break;
 			case MSG_OK:			/* Il client ha inviato il nome dell'avversario */
-				strcpy(guest, receive->buffer);
-				if (isUser_Mutex(guest) && (getUserStatus_Mutex(guest) == WAITING)) {
-					guest_sock = getUserChannel_Mutex(guest);
-					setUserStatus_Mutex(player, PLAYING);
-					setUserStatus_Mutex(guest, PLAYING);
+				/* L'avversario viene portato nello stato PLAYING solo se è ancora in attesa (in un'unica operazione) */
+				if (receive->buffer != NULL && receive->length <= LUSER+1 && receive->buffer[receive->length-1] == '\0' &&
+						(guest_sock = claimUser_Mutex(receive->buffer, &guest_handle)) >= 0) {
+					strcpy(guest, receive->buffer);
+					updateUser_Mutex(handle, PLAYING, sock);
 					ec_neg1 ( createMessage(send, MSG_OK, NULL) )
 					ec_neg1 ( sendMessage(sock, send) )
-					ec_rv ( Play(sock, guest_sock, player, guest) )
-					setUserStatus_Mutex(player, DISCONNECTED);
-					setUserChannel_Mutex(player, -1);
-					setUserStatus_Mutex(guest, DISCONNECTED);
-					setUserChannel_Mutex(guest, -1);
-					ec_neg1 ( closeConnection(guest_sock) )
+					if ((errno = Play(sock, guest_sock, player, guest)) != 0) {
+						sock = -1;	/* Play ha già chiuso entrambe le connessioni */
+						EC_FAIL
+					}
+					releaseUser_Mutex(handle, chan);
+					releaseUser_Mutex(guest_handle, guest_sock);
+					guest_handle = NULL;
+					ec_neg1 ( CloseClient(guest_sock) )
 				}
 				else {
 					ec_neg1 ( createMessage(send, MSG_NO, NOUSR_ERROR) )
@@ -1135,8 +1582,11 @@ void* Worker(void* arg)
 	}
 	
 	/* Se il client è stato messo in attesa, non devo chiudere la connessione */
-	if (!waiting) closeConnection(sock);
-	return NULL;
+	if (!waiting) {
+		if (handle != NULL) releaseUser_Mutex(handle, chan);
+		CloseClient(sock);
+	}
+	return;
 	
 	EC_CLEANUP_BGN
 		
@@ -1152,13 +1602,175 @@ void* Worker(void* arg)
 			free(send);
 		}
 		
-		closeConnection(sock);
+		/* La sessione viene chiusa: gli utenti coinvolti tornano disconnessi */
+		if (handle != NULL) releaseUser_Mutex(handle, chan);
+		if (guest_handle != NULL) releaseUser_Mutex(guest_handle, guest_sock);
+		if (sock != -1) CloseClient(sock);
 		
-		return NULL;
+		return;
 		
 	EC_CLEANUP_END
 }
 
+/** Funzione del thread di connessione al client
+ * 
+ * \param arg elemento del registro dei thread associato al thread (contiene il file descriptor della connessione)
+ * 
+ * \retval NULL
+ */
+
+void* Worker(void* arg)
+{
+	tlist* el = (tlist*) arg;
+	pthread_detach(pthread_self());
+	ServeClient(el->fd);
+	RemoveThread(el);
+	return NULL;
+}
+
+/** Numero massimo di connessioni in attesa di un thread del pool */
+#define QUEUE_SIZE 128
+
+/** Timeout (in secondi) delle ricezioni sulle connessioni servite dal pool: un thread del pool resta
+    legato ad un client per tutta la sessione (login, scelta dell'avversario e partita), per cui un client
+    che non invia nulla per più di \c POOL_TIMEOUT secondi viene disconnesso e libera il thread (il valore è riportato in \c SR_RIGHT_WAY) */
+#define POOL_TIMEOUT 60
+
+/** Coda circolare limitata delle connessioni accettate, in attesa di un thread del pool */
+static int fd_queue[QUEUE_SIZE];
+/** Indice del primo elemento di \c fd_queue */
+static int queue_head = 0;
+/** Numero di elementi in \c fd_queue */
+static int queue_count = 0;
+/** TRUE se il pool è in chiusura */
+static bool_t queue_closed = FALSE;
+/** Mutex per la coda \c fd_queue */
+static pthread_mutex_t queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+/** Variabile di condizione per l'attesa di una connessione da parte dei thread del pool */
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+
+/** Inserimento di una connessione in coda per i thread del pool (senza attesa)
+ * 
+ * \param fd file descriptor della connessione
+ * 
+ * \retval 0 se tutto ok
+ * \retval -1 se la coda è piena (\c errno = \c EAGAIN ) o si è verificato un errore (setta \c errno)
+ */
+int PushClient(int fd)
+{
+	int r = 0;
+	ec_rv ( pthread_mutex_lock(&queue_mutex) )
+	if (queue_count == QUEUE_SIZE) {
+		errno = EAGAIN;
+		r = -1;
+	}
+	else {
+		fd_queue[(queue_head + queue_count) % QUEUE_SIZE] = fd;
+		queue_count++;
+		ec_rv ( pthread_cond_signal(&queue_cond) )
+	}
+	ec_rv ( pthread_mutex_unlock(&queue_mutex) )
+	return r;
+	
+	EC_CLEANUP_BGN
+		pthread_mutex_unlock(&queue_mutex);
+		return -1;
+	EC_CLEANUP_END
+}
+
+/** Estrazione di una connessione dalla coda del pool (con attesa se la coda è vuota)
+ * 
+ * \retval fd file descriptor della connessione
+ * \retval -1 se il pool è in chiusura o si è verificato un errore
+ */
+int PopClient()
+{
+	int fd = -1;
+	ec_rv ( pthread_mutex_lock(&queue_mutex) )
+	while (queue_count == 0 && !queue_closed)
+		ec_rv ( pthread_cond_wait(&queue_cond, &queue_mutex) )
+	if (queue_count > 0) {
+		fd = fd_queue[queue_head];
+		queue_head = (queue_head + 1) % QUEUE_SIZE;
+		queue_count--;
+	}
+	ec_rv ( pthread_mutex_unlock(&queue_mutex) )
+	return fd;
+	
+	EC_CLEANUP_BGN
+		pthread_mutex_unlock(&queue_mutex);
+		return -1;
+	EC_CLEANUP_END
+}
+
+/** Chiusura del pool: i thread del pool terminano dopo aver servito le connessioni già accodate
+ * (è una funzione di cleanup per la cancellazione del thread \c Dispatcher)
+ * 
+ * \param arg (non usato)
+ */
+void ClosePool(void* arg)
+{
+	ec_rv ( pthread_mutex_lock(&queue_mutex) )
+	queue_closed = TRUE;
+	ec_rv ( pthread_cond_broadcast(&queue_cond) )
+	ec_rv ( pthread_mutex_unlock(&queue_mutex) )
+	return;
+	
+	EC_CLEANUP_BGN
+		pthread_mutex_unlock(&queue_mutex);
+		return;
+	EC_CLEANUP_END
+}
+
+/** Rifiuta una connessione per sovraccarico del server (coda del pool piena o impossibile avviare un thread)
+ * 
+ * \param sock file descriptor della connessione
+ */
+void RejectClient(int sock)
+{
+	message_t busy;
+	busy.type = MSG_ERR;
+	busy.buffer = SERVER_BUSY;
+	busy.length = strlen(SERVER_BUSY)+1;
+	sendMessage(sock, &busy);
+	closeConnection(sock);
+}
+
+/** Imposta il timeout \c POOL_TIMEOUT sulle ricezioni da una connessione servita dal pool (una
+ * ricezione scaduta fallisce con \c errno = \c EAGAIN e la sessione viene chiusa)
+ * 
+ * \param sock file descriptor della connessione
+ * 
+ * \retval 0 se tutto ok
+ * \retval -1 se si è verificato un errore (setta \c errno)
+ */
+int SetPoolTimeout(int sock)
+{
+	struct timeval tv;
+	tv.tv_sec = POOL_TIMEOUT;
+	tv.tv_usec = 0;
+	return setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+/** Funzione dei thread del pool: estrae dalla coda le connessioni accettate dal \c Dispatcher e le serve
+ * (con il timeout \c POOL_TIMEOUT sulle ricezioni, per cui un client inattivo non trattiene il thread)
+ * 
+ * \param arg elemento del registro dei thread associato al thread
+ * 
+ * \retval NULL
+ */
+void* PoolWorker(void* arg)
+{
+	int sock;
+	pthread_detach(pthread_self());
+	while ((sock = PopClient()) != -1) {
+		if (SetPoolTimeout(sock) == -1) RejectClient(sock);
+		else ServeClient(sock);
+	}
+	RemoveThread((tlist*) arg);
+	return NULL;
+}
+
 /** Funzione del thread dispatcher
  * 
  * \param arg file descriptor della socket del server (castata a \c void* )
@@ -1167,32 +1779,51 @@ void* Worker(void* arg)
  * 
  * \section commagg4 Commenti Aggiuntivi
  * Il thread si occupa di accettare le connessioni dai client e di far partire i corrispondenti thread \c Worker;
- * l'ID di ogni nuovo thread viene inserito in lista. Il \c Dispatcher verrà cancellato dal \c Signaler; quando ciò
- * accade, viene chiamata la \c joinAllThreads per consentire una corretta terminazione dei \c Worker.
+ * ogni nuovo thread viene inserito nel registro dei thread attivi, da cui si rimuove da solo al termine. Il
+ * \c Dispatcher verrà cancellato dal \c Signaler; quando ciò accade, viene chiamata la \c waitAllThreads per
+ * consentire una corretta terminazione dei \c Worker.
+ * Con l'opzione \c -p i thread del pool vengono avviati all'inizio e le connessioni accettate sono inserite nella
+ * coda \c fd_queue; se la coda è piena il client riceve un messaggio MSG_ERR e la connessione viene chiusa.
  */
 void* Dispatcher(void* arg) 
 {
-	int *mainsock_p = NULL, mainsock;
+	int *mainsock_p = NULL, mainsock, i, fd_c;
+	pthread_t actual;
+	tlist* el = NULL;
 	mainsock_p = (int*) arg;
 	mainsock = *mainsock_p;
 	
 	/* Push della funzione di attesa thread Worker */
-	pthread_cleanup_push(&joinAllThreads, NULL);
+	pthread_cleanup_push(&waitAllThreads, NULL);
+	pthread_cleanup_push(&ClosePool, NULL);
 	
-	while (!CheckTermSignal()) {
-		pthread_t actual;
-		int* fd_c = NULL;
-		ec_null ( fd_c = (int*)malloc(sizeof(int)) )
-		pthread_cleanup_push(&freefd, fd_c);
+	/* Avvio dei thread del pool */
+	for (i = 0; i < p_option; i++) {
+		ec_null ( el = RegisterThread(-1) )
+		if ((errno = pthread_create(&actual, NULL, &PoolWorker, el)) != 0) {
+			RemoveThread(el);
+			EC_FAIL
+		}
+	}
 	
+	while (!CheckTermSignal() && p_option > 0) {
+		/* Attesa della connessione di un client e inserimento nella coda del pool */
+		ec_neg1 ( fd_c = acceptConnection(mainsock) )
+		if (PushClient(fd_c) == -1) RejectClient(fd_c);
+	}
+	
+	while (!CheckTermSignal()) {
 		/* Attesa della connessione di un client */
-		ec_neg1 ( (*fd_c) = acceptConnection(mainsock) )
-		/* Avvio di un nuovo thread Worker ed inserimento dell'ID di quest'ultimo in coda alla lista */
-		ec_nzero ( pthread_create(&actual, NULL, &Worker, fd_c) )
-		threadList_head = NuovoInCoda(threadList_head, actual);
-		pthread_cleanup_pop(0);
+		ec_neg1 ( fd_c = acceptConnection(mainsock) )
+		/* Registrazione e avvio di un nuovo thread Worker (se non è possibile, il client viene rifiutato) */
+		if ((el = RegisterThread(fd_c)) == NULL) RejectClient(fd_c);
+		else if (pthread_create(&actual, NULL, &Worker, el) != 0) {
+			RemoveThread(el);
+			RejectClient(fd_c);
+		}
 	}
 	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
 	return NULL;
 	
 	EC_CLEANUP_BGN
@@ -1202,9 +1833,642 @@ void* Dispatcher(void* arg)
 	EC_CLEANUP_END
 }	
 
+/* -= SERVER AD EVENTI =- */
+
+/** Numero massimo di eventi restituiti da una \c epoll_wait */
+#define MAXEVENTS 256
+
+/** Stati di una connessione gestita dal thread \c Reactor
+ * - \c C_LOGIN attesa del primo messaggio (registrazione, cancellazione, disconnessione o connessione)
+ * - \c C_CHOOSE il client ha ricevuto la lista degli utenti in attesa e deve scegliere l'avversario
+ * - \c C_WAITING il client è in attesa di essere sfidato
+ * - \c C_PLAYING il client è impegnato in una partita
+ * - \c C_CLOSING la connessione verrà chiusa non appena il buffer di invio sarà vuoto
+ * - \c C_DEAD la connessione è chiusa, la struttura verrà deallocata al termine del ciclo di eventi
+ */
+typedef enum cstate { C_LOGIN, C_CHOOSE, C_WAITING, C_PLAYING, C_CLOSING, C_DEAD } cstate_t;
+
+struct _partita;
+
+/** Connessione gestita dal thread \c Reactor */
+typedef struct _conn {
+/** File descriptor della connessione */
+	int fd;
+/** Stato della connessione */
+	cstate_t state;
+/** Buffer di ricezione */
+	rbuf_t* rb;
+/** Buffer di invio */
+	sbuf_t* sb;
+/** Eventi attualmente registrati su epoll */
+	unsigned int events;
+/** Username del client (significativo dopo la connessione) */
+	char player[LUSER+1];
+/** Nodo dell'utente connesso (\c NULL prima della connessione) */
+	nodo_t* user;
+/** Partita in corso (significativo nello stato \c C_PLAYING) */
+	struct _partita* game;
+/** Indice del giocatore nella partita (0 sfidante, 1 sfidato) */
+	int seat;
+/** Elemento successivo nella lista delle connessioni chiuse */
+	struct _conn* next;
+} conn_t;
+
+/** Stato di una partita gestita dal thread \c Reactor */
+typedef struct _partita {
+/** Connessioni dei giocatori (0 sfidante, 1 sfidato) */
+	conn_t* pl[2];
+/** Stato della partita (i giocatori sono indicizzati come \c pl) */
+	game_t game;
+/** Messaggio con cui il giocatore di mano ha giocato la carta */
+	message_t ledmsg;
+/** File di log della partita */
+	FILE* log;
+} partita_t;
+
+/** File descriptor di epoll del thread \c Reactor */
+static int reactor_epfd = -1;
+/** Connessioni del thread \c Reactor, indicizzate per file descriptor */
+static conn_t** conns = NULL;
+/** Connessioni chiuse durante il ciclo di eventi corrente, da deallocare */
+static conn_t* dead_conns = NULL;
+
+/** Chiude una connessione del thread \c Reactor, disconnettendo l'utente eventualmente associato. La struttura
+ * viene deallocata alla fine del ciclo di eventi corrente, in quanto potrebbe comparire fra gli eventi non ancora
+ * elaborati
+ * 
+ * \param c connessione da chiudere
+ */
+void CloseConn(conn_t* c)
+{
+	if (c->state == C_DEAD) return;
+	if (c->user != NULL) releaseUser_Mutex(c->user, c->fd);
+	epoll_ctl(reactor_epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	conns[c->fd] = NULL;
+	closeConnection(c->fd);
+	c->fd = -1;
+	c->state = C_DEAD;
+	c->next = dead_conns;
+	dead_conns = c;
+}
+
+/** Dealloca le connessioni chiuse durante il ciclo di eventi corrente */
+void FreeDeadConns()
+{
+	while (dead_conns != NULL) {
+		conn_t* temp = dead_conns;
+		dead_conns = dead_conns->next;
+		freeRecvBuffer(temp->rb);
+		freeSendBuffer(temp->sb);
+		free(temp);
+	}
+}
+
+/** Controlla se lo stato di una connessione prevede la ricezione di un messaggio dal client
+ * 
+ * \param c connessione
+ * 
+ * \retval TRUE se si attende un messaggio dal client
+ * \retval FALSE altrimenti
+ */
+bool_t ExpectsInput(conn_t* c)
+{
+	partita_t* g = c->game;
+	switch (c->state) {
+		case C_LOGIN:
+		case C_CHOOSE:
+			return TRUE;
+		case C_PLAYING:
+			return (c->seat == gameTurn(&(g->game))) ? TRUE : FALSE;
+		default:
+			return FALSE;
+	}
+}
+
+/** Aggiorna gli eventi registrati su epoll per una connessione: la lettura è abilitata solo se lo stato
+ * prevede un messaggio dal client, la scrittura solo se il buffer di invio non è vuoto
+ * 
+ * \param c connessione
+ * 
+ * \retval 0 se tutto ok
+ * \retval -1 se si è verificato un errore (setta \c errno)
+ */
+int UpdateInterest(conn_t* c)
+{
+	struct epoll_event ev;
+	
+	ev.events = EPOLLRDHUP;
+	if (ExpectsInput(c)) ev.events |= EPOLLIN;
+	if (c->sb->end > c->sb->start) ev.events |= EPOLLOUT;
+	if (ev.events == c->events) return 0;
+	ev.data.ptr = c;
+	if (epoll_ctl(reactor_epfd, EPOLL_CTL_MOD, c->fd, &ev) == -1) return -1;
+	c->events = ev.events;
+	return 0;
+}
+
+/** Accoda un messaggio sul buffer di invio di una connessione
+ * 
+ * \param c connessione
+ * \param type tipo del messaggio
+ * \param buf contenuto del messaggio (stringa terminata, o \c NULL)
+ * 
+ * \retval 0 se tutto ok
+ * \retval -1 se si è verificato un errore (setta \c errno)
+ */
+int QueueReply(conn_t* c, char type, char* buf)
+{
+	message_t msg;
+	msg.type = type;
+	msg.buffer = buf;
+	msg.length = (buf != NULL) ? strlen(buf)+1 : 0;
+	return queueMessage(c->sb, &msg);
+}
+
+/** Invia i messaggi accodati su una connessione; la connessione viene chiusa se si verifica un errore
+ * oppure se è in chiusura e il buffer è stato svuotato
+ * 
+ * \param c connessione
+ */
+void FlushConn(conn_t* c)
+{
+	int pending;
+	
+	if (c->state == C_DEAD) return;
+	if ((pending = flushSendBuffer(c->sb)) == -1 || (pending == 0 && c->state == C_CLOSING) || UpdateInterest(c) == -1)
+		CloseConn(c);
+}
+
+/** Termina una partita del thread \c Reactor: chiude il file di log, riporta i giocatori nello stato
+ * \c DISCONNECTED e mette in chiusura entrambe le connessioni
+ * 
+ * \param g partita da terminare
+ */
+void EndGame(partita_t* g)
+{
+	int i;
+	
+	for (i = 0; i < 2; i++) {
+		if (g->pl[i]->state != C_DEAD) releaseUser_Mutex(g->pl[i]->user, g->pl[i]->fd);
+		g->pl[i]->game = NULL;
+		if (g->pl[i]->state != C_DEAD) g->pl[i]->state = C_CLOSING;
+	}
+	if (g->log != NULL) fclose(g->log);
+	if (g->ledmsg.buffer != NULL) free(g->ledmsg.buffer);
+	free(g);
+}
+
+/** Avvia una partita del thread \c Reactor: crea il file di log, distribuisce le carte e accoda i messaggi
+ * MSG_STARTGAME
+ * 
+ * \param c1 connessione dello sfidante
+ * \param c2 connessione dello sfidato
+ * 
+ * \retval 0 se tutto ok
+ * \retval -1 se si è verificato un errore (setta \c errno)
+ */
+int StartGame(conn_t* c1, conn_t* c2)
+{
+	int i, j, ngame;
+	char numb[12], filename[sizeof(LOG_NAME_ST)+sizeof(LOG_NAME_END)+12], buf[2][LUSER+11], cd[3];
+	partita_t* g = NULL;
+	
+	ec_null ( g = (partita_t*)calloc(1, sizeof(partita_t)) )
+	g->pl[0] = c1;
+	g->pl[1] = c2;
+	
+	ec_rv ( pthread_mutex_lock(&plays_mutex) )
+	ngame = ++npart;
+	sprintf(numb, "%d", npart);
+	ec_rv ( pthread_mutex_unlock(&plays_mutex) )
+	sprintf(filename, "%s%s%s", LOG_NAME_ST, numb, LOG_NAME_END);
+	ec_null ( g->log = fopen(filename, "w") )
+	
+	ec_neg1 ( NewGame(&(g->game), ngame) )
+	fprintf(g->log, FIRST_LOG, c1->player, c2->player, semeToChar(g->game.deck.briscola));
+	if (!t_option) fprintf(g->log, SEED_LOG, (unsigned long long)(seed_base + ngame));
+	
+	/* Messaggi MSG_STARTGAME con le carte distribuite */
+	for (i = 0; i < 2; i++) {
+		buf[i][0] = semeToChar(g->game.deck.briscola);
+		buf[i][1] = ':';
+		buf[i][2] = '\0';
+		for (j = 0; j < 3; j++) {
+			packedToString(cd, g->game.dealt[i][j]);
+			strcat(buf[i], cd);
+		}
+	}
+	for (i = 0; i < 2; i++) {
+		strcat(buf[i], ":");
+		strcat(buf[i], g->pl[1-i]->player);
+		g->pl[i]->state = C_PLAYING;
+		g->pl[i]->game = g;
+		g->pl[i]->seat = i;
+		ec_neg1 ( QueueReply(g->pl[i], MSG_STARTGAME, buf[i]) )
+	}
+	return 0;
+	
+	EC_CLEANUP_BGN
+		pthread_mutex_unlock(&plays_mutex);
+		if (g != NULL) {
+			if (g->log != NULL) fclose(g->log);
+			c1->game = NULL;
+			c2->game = NULL;
+			free(g);
+		}
+		return -1;
+	EC_CLEANUP_END
+}
+
+/** Gestisce la carta giocata da un giocatore in una partita del thread \c Reactor
+ * 
+ * \param c connessione del giocatore di turno
+ * \param msg messaggio ricevuto (il buffer passa alla partita o viene deallocato)
+ * 
+ * \retval 0 se tutto ok
+ * \retval -1 se si è verificato un errore (setta \c errno)
+ * 
+ * \section commagg5 Commenti Aggiuntivi
+ * La logica del turno è la stessa della Play: il giocatore di mano gioca per primo e la sua carta viene
+ * comunicata all'avversario; quando gioca il secondo si decreta il vincitore del turno, che pesca per primo
+ * e sarà di mano nel turno successivo. Le risposte di fine turno sono accodate insieme ai messaggi MSG_CARD.
+ */
+int GameMove(conn_t* c, message_t* msg)
+{
+	partita_t* g = c->game;
+	const trick_t* t = NULL;
+	card_t played = NOCARD;
+	int i, lead, res, points[2];
+	char cd[3], cardmsg[2][5], winpoints[12], winstring[LUSER+14], *winname;
+	message_t reply;
+	
+	/* Controllo sulla validità della carta giocata */
+	if (msg->buffer != NULL && msg->buffer[msg->length-1] == '\0') played = stringToPacked(msg->buffer);
+	if ((res = gamePlay(&(g->game), c->seat, played)) == -1) {
+		if (msg->buffer != NULL) free(msg->buffer);
+		if (errno == EINVAL) return QueueReply(c, MSG_ERR, NOT_A_CARD);
+		if (errno == ENOENT) return QueueReply(c, MSG_ERR, NOT_IN_DECK);
+		return -1;
+	}
+	
+	/* Ha giocato il primo: la carta viene comunicata al secondo */
+	if (res == 0) {
+		g->ledmsg = *msg;
+		return QueueReply(g->pl[1-c->seat], MSG_PLAY, msg->buffer);
+	}
+	
+	/* Ha giocato il secondo: fine del turno */
+	lead = 1-c->seat;
+	t = gameTrickResult(&(g->game));
+	fprintf(g->log, "%s:%s#%s:%s\n", g->pl[lead]->player, g->ledmsg.buffer, c->player, msg->buffer);
+	
+	/* Carte pescate (il vincitore pesca per primo) */
+	for (i = 0; i < 2; i++) {
+		played = t->drawn[(i == 0) ? t->winner : 1-t->winner];
+		if (played != NOCARD) packedToString(cd, played);
+		else strcpy(cd, "NN");
+		sprintf(cardmsg[i], "%c:%s", (i == 0) ? 't' : 'a', cd);
+	}
+	
+	/* Risposte di fine turno: MSG_PLAY al giocatore di mano, MSG_OK all'altro, seguiti dai messaggi MSG_CARD */
+	reply.type = MSG_PLAY;
+	reply.length = msg->length;
+	reply.buffer = msg->buffer;
+	ec_neg1 ( queueMessage(g->pl[lead]->sb, &reply) )
+	ec_neg1 ( QueueReply(c, MSG_OK, NULL) )
+	free(msg->buffer);
+	msg->buffer = NULL;
+	free(g->ledmsg.buffer);
+	g->ledmsg.buffer = NULL;
+	if (!gameIsOver(&(g->game))) {
+		ec_neg1 ( QueueReply(g->pl[t->winner], MSG_CARD, cardmsg[0]) )
+		ec_neg1 ( QueueReply(g->pl[1-t->winner], MSG_CARD, cardmsg[1]) )
+		return 0;
+	}
+	
+	/* Fine partita: conteggio punti e decretazione vincitore */
+	points[0] = gameScore(&(g->game), 0);
+	points[1] = gameScore(&(g->game), 1);
+	if (points[0] != points[1]) {
+		i = (points[0] > points[1]) ? 0 : 1;
+		winname = g->pl[i]->player;
+		sprintf(winpoints, "%d", points[i]);
+	}
+	else {
+		winname = DRAW;
+		strcpy(winpoints, "60");
+	}
+	fprintf(g->log, LAST_LOG, winname, winpoints);
+	sprintf(winstring, "%s:%s", winname, winpoints);
+	ec_neg1 ( QueueReply(g->pl[0], MSG_ENDGAME, winstring) )
+	ec_neg1 ( QueueReply(g->pl[1], MSG_ENDGAME, winstring) )
+	EndGame(g);
+	return 0;
+	
+	EC_CLEANUP_BGN
+		if (msg->buffer != NULL) free(msg->buffer);
+		return -1;
+	EC_CLEANUP_END
+}
+
+/** Gestisce il primo messaggio di una connessione del thread \c Reactor (stato \c C_LOGIN). Le operazioni
+ * sono le stesse del thread \c Worker
+ * 
+ * \param c connessione
+ * \param msg messaggio ricevuto
+ * 
+ * \retval 0 se tutto ok
+ * \retval -1 se si è verificato un errore (setta \c errno)
+ */
+int HandleLogin(conn_t* c, message_t* msg)
+{
+	message_t* send = NULL;
+	int r = 0;
+	
+	if (msg->buffer == NULL || msg->buffer[msg->length-1] != '\0') {
+		c->state = C_CLOSING;
+		return QueueReply(c, MSG_ERR, ERR_STRTOU);
+	}
+	switch (msg->type) {
+		case MSG_REG:
+			send = User_Register(msg->buffer);
+			c->state = C_CLOSING;
+			break;
+		case MSG_CANC:
+			send = User_Cancel(msg->buffer);
+			c->state = C_CLOSING;
+			break;
+		case MSG_DISC:
+			send = User_Disconnect(msg->buffer);
+			c->state = C_CLOSING;
+			break;
+		case MSG_CONNECT:
+		case MSG_LOBBY:
+			send = User_Setup(msg->buffer, msg->type == MSG_LOBBY, c->player, c->fd, &(c->user));
+			if (send == NULL) break;
+			if (send->type == MSG_OK) c->state = C_CHOOSE;	/* Si può scegliere uno sfidante */
+			else if (send->type == MSG_WAIT) c->state = C_WAITING;	/* Nessuno sfidante disponibile */
+			else c->state = C_CLOSING;
+			break;
+		default:
+			c->state = C_CLOSING;
+			return QueueReply(c, MSG_ERR, NOT_SUPPORTED);
+	}
+	if (send == NULL) return -1;
+	r = queueMessage(c->sb, send);
+	if (send->buffer != NULL) free(send->buffer);
+	free(send);
+	return r;
+}
+
+/** Gestisce la scelta dell'avversario di una connessione del thread \c Reactor (stato \c C_CHOOSE)
+ * 
+ * \param c connessione
+ * \param msg messaggio ricevuto
+ * 
+ * \retval 0 se tutto ok
+ * \retval -1 se si è verificato un errore (setta \c errno)
+ */
+int HandleChoice(conn_t* c, message_t* msg)
+{
+	int guest_sock;
+	conn_t* guest = NULL;
+	nodo_t* guest_h = NULL;
+	
+	switch (msg->type) {
+		case MSG_WAIT:	/* Il client ha deciso di aspettare */
+			updateUser_Mutex(c->user, WAITING, c->fd);
+			c->state = C_WAITING;
+			return QueueReply(c, MSG_OK, NULL);
+		case MSG_OK:	/* Il client ha inviato il nome dell'avversario */
+			if (msg->buffer != NULL && msg->buffer[msg->length-1] == '\0' && msg->length <= LUSER+1 &&
+					(guest_sock = claimUser_Mutex(msg->buffer, &guest_h)) >= 0) {
+				if (guest_sock < conn_max && conns[guest_sock] != NULL && conns[guest_sock]->user == guest_h &&
+						conns[guest_sock]->state == C_WAITING)
+					guest = conns[guest_sock];
+				else updateUser_Mutex(guest_h, WAITING, guest_sock);	/* Sfida non valida, l'avversario resta in attesa */
+			}
+			if (guest == NULL) {
+				c->state = C_CLOSING;
+				return QueueReply(c, MSG_NO, NOUSR_ERROR);
+			}
+			updateUser_Mutex(c->user, PLAYING, c->fd);
+			if (QueueReply(c, MSG_OK, NULL) == -1) return -1;
+			if (StartGame(c, guest) == -1) return -1;
+			FlushConn(guest);
+			return 0;
+		default:
+			c->state = C_CLOSING;
+			return QueueReply(c, MSG_ERR, NOT_SUPPORTED);
+	}
+}
+
+/** Chiude una connessione del thread \c Reactor a seguito di un errore o della disconnessione del client,
+ * ripristinando lo stato dell'utente; se il client era impegnato in una partita, questa viene interrotta
+ * e viene chiusa anche la connessione dell'avversario (come nella Play)
+ * 
+ * \param c connessione
+ */
+void DropConn(conn_t* c)
+{
+	partita_t* g = c->game;
+	
+	if (c->state == C_DEAD) return;
+	if (g != NULL) {
+		conn_t* other = g->pl[1-c->seat];
+		EndGame(g);
+		CloseConn(other);
+	}
+	CloseConn(c);
+}
+
+/** Elabora i messaggi completi presenti nel buffer di ricezione di una connessione, finché lo stato
+ * della connessione ne prevede
+ * 
+ * \param c connessione
+ * 
+ * \retval 0 se tutto ok
+ * \retval -1 se si è verificato un errore (setta \c errno)
+ */
+int PumpConn(conn_t* c)
+{
+	message_t msg;
+	conn_t* other = NULL;
+	int r = 0;
+	
+	while (r == 0 && c->state != C_DEAD && ExpectsInput(c)) {
+		if (extractMessage(c->rb, &msg) == -1) 
+			return (errno == EAGAIN) ? 0 : -1;
+		switch (c->state) {
+			case C_LOGIN:
+				r = HandleLogin(c, &msg);
+				if (msg.buffer != NULL) free(msg.buffer);
+				break;
+			case C_CHOOSE:
+				r = HandleChoice(c, &msg);
+				if (msg.buffer != NULL) free(msg.buffer);
+				break;
+			case C_PLAYING:
+				other = c->game->pl[1-c->seat];
+				if ((r = GameMove(c, &msg)) == -1) break;
+				FlushConn(other);
+				/* L'avversario potrebbe avere già inviato la propria carta */
+				if (c->state == C_PLAYING && other->state == C_PLAYING && PumpConn(other) == -1)
+					DropConn(other);
+				break;
+			default:
+				break;
+		}
+	}
+	return r;
+}
+
+/** Gestisce gli eventi di una connessione del thread \c Reactor
+ * 
+ * \param c connessione
+ * \param events eventi restituiti da \c epoll_wait
+ */
+void HandleEvents(conn_t* c, unsigned int events)
+{
+	if (c->state == C_DEAD) return;
+	if ((events & EPOLLIN) && ExpectsInput(c)) {
+		if (fillRecvBuffer(c->rb) == -1 && errno != EAGAIN) {
+			DropConn(c);
+			return;
+		}
+		if (PumpConn(c) == -1) {
+			DropConn(c);
+			return;
+		}
+	}
+	if (c->state != C_DEAD && (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+		DropConn(c);
+		return;
+	}
+	FlushConn(c);
+}
+
+/** Accetta tutte le connessioni pendenti sulla socket del server (non bloccante) e le registra su epoll
+ * 
+ * \param mainsock file descriptor della socket del server
+ * 
+ * \retval 0 se tutto ok
+ * \retval -1 se si è verificato un errore (setta \c errno)
+ */
+int AcceptAll(int mainsock)
+{
+	int fd;
+	conn_t* c = NULL;
+	struct epoll_event ev;
+	
+	while ((fd = acceptConnection(mainsock)) != -1) {
+		if (fd >= conn_max || setNonBlocking(fd) == -1 || (c = (conn_t*)calloc(1, sizeof(conn_t))) == NULL) {
+			closeConnection(fd);
+			continue;
+		}
+		c->fd = fd;
+		c->state = C_LOGIN;
+		c->rb = createRecvBuffer(fd);
+		c->sb = createSendBuffer(fd);
+		c->events = EPOLLIN | EPOLLRDHUP;
+		ev.events = c->events;
+		ev.data.ptr = c;
+		if (c->rb == NULL || c->sb == NULL || epoll_ctl(reactor_epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+			freeRecvBuffer(c->rb);
+			freeSendBuffer(c->sb);
+			free(c);
+			closeConnection(fd);
+			continue;
+		}
+		conns[fd] = c;
+	}
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNABORTED || errno == EINTR) return 0;
+	return -1;
+}
+
+/** Chiude tutte le connessioni del thread \c Reactor
+ * (è una funzione di cleanup per la cancellazione del thread \c Reactor)
+ * 
+ * \param arg (non usato)
+ */
+void CloseAllConns(void* arg)
+{
+	long i;
+	for (i = 0; i < conn_max; i++) {
+		if (conns[i] != NULL) {
+			if (conns[i]->game != NULL) EndGame(conns[i]->game);
+			CloseConn(conns[i]);
+		}
+	}
+	FreeDeadConns();
+	if (reactor_epfd != -1) close(reactor_epfd);
+	reactor_epfd = -1;
+	free(conns);
+	conns = NULL;
+}
+
+/** Funzione del thread del server ad eventi
+ * 
+ * \param arg file descriptor della socket del server (castata a \c void* )
+ * 
+ * \retval NULL
+ * 
+ * \section commagg6 Commenti Aggiuntivi
+ * Il thread sostituisce i thread \c Dispatcher e \c Worker quando il server è avviato con l'opzione \c -e: tutte le
+ * connessioni sono non bloccanti e gestite da un unico ciclo \c epoll, in cui login, scelta dell'avversario, attesa
+ * e turni di gioco sono stati espliciti di ogni connessione. Il thread viene cancellato dal \c Signaler; la
+ * cancellazione è abilitata solo durante la \c epoll_wait, e la funzione di cleanup chiude tutte le connessioni.
+ */
+void* Reactor(void* arg)
+{
+	int *mainsock_p = NULL, mainsock, n, i;
+	struct epoll_event ev, *events = NULL;
+	mainsock_p = (int*) arg;
+	mainsock = *mainsock_p;
+	
+	ec_null ( conns = (conn_t**)calloc(conn_max, sizeof(conn_t*)) )
+	ec_null ( events = (struct epoll_event*)malloc(MAXEVENTS*sizeof(struct epoll_event)) )
+	ec_neg1 ( reactor_epfd = epoll_create1(0) )
+	ec_neg1 ( setNonBlocking(mainsock) )
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	ec_neg1 ( epoll_ctl(reactor_epfd, EPOLL_CTL_ADD, mainsock, &ev) )
+	
+	pthread_cleanup_push(&freefd, events);
+	pthread_cleanup_push(&CloseAllConns, NULL);
+	ec_rv ( pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL) )
+	
+	while (!CheckTermSignal()) {
+		ec_rv ( pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL) )
+		n = epoll_wait(reactor_epfd, events, MAXEVENTS, -1);
+		ec_rv ( pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL) )
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			EC_FAIL
+		}
+		for (i = 0; i < n; i++) {
+			if (events[i].data.ptr == NULL) {
+				ec_neg1 ( AcceptAll(mainsock) )
+			}
+			else HandleEvents((conn_t*)events[i].data.ptr, events[i].events);
+		}
+		FreeDeadConns();
+	}
+	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
+	return NULL;
+	
+	EC_CLEANUP_BGN
+	
+		return NULL;
+	
+	EC_CLEANUP_END
+}
+
 int main(int argc, char **argv)
 {
-	int socket_desc = -1, err = 0, n_users;
+	int socket_desc = -1, err = 0, n_users, n_ops, i;
+	char* journal_file = NULL;
 	pthread_t signaler = 0, dispatch = 0;
 	FILE *utenti_r = NULL;
 	sigset_t sgs;
@@ -1217,28 +2481,41 @@ int main(int argc, char **argv)
 	ec_neg1 ( sigaddset(&sgs, SIGINT) )
 	ec_neg1 ( sigaddset(&sgs, SIGTERM) )
 	ec_neg1 ( sigaddset(&sgs, SIGUSR1) )
+	ec_neg1 ( sigaddset(&sgs, SIGCHLD) )
 	ec_neg1 ( sigaddset(&sgs, SIGPIPE) )
 	ec_rv ( err = pthread_sigmask(SIG_SETMASK, &sgs, NULL) )
 	
 	
+	/* Inizializzazione dei lock di riga degli utenti */
+	for (i = 0; i < NSTRIPES; i++)
+		ec_rv ( err = pthread_mutex_init(&user_stripe[i], NULL) )
+	ec_rv ( err = pthread_key_create(&list_key, &FreeListBuffer) )
+	
 	/* Controllo input della riga di comando */
 	if (argc == 1) {
 		fprintf(stderr, "%s\n", NO_USRLIST);
 		fprintf(stderr, "%s\n", SR_RIGHT_WAY);
 		exit(EXIT_FAILURE);
 	}
-	if (argc > 3) {
+	if (argc > 6) {
 		fprintf(stderr, "%s\n", TOO_MANY_PAR);
 		fprintf(stderr, "%s\n", SR_RIGHT_WAY);
 		exit(EXIT_FAILURE);
 	}
-	if (argc == 3) {
-		if (strcmp(argv[2], TEST_OPTN) != 0) {
+	for (i = 2; i < argc; i++) {
+		if (strcmp(argv[i], TEST_OPTN) == 0 && !t_option) t_option = TRUE;
+		else if (strcmp(argv[i], EPOLL_OPTN) == 0 && !e_option) e_option = TRUE;
+		else if (strcmp(argv[i], POOL_OPTN) == 0 && p_option == 0 && i+1 < argc && (p_option = atoi(argv[i+1])) > 0) i++;
+		else {
 			fprintf(stderr, "%s\n", WRONG_PAR);
 			fprintf(stderr, "%s\n", SR_RIGHT_WAY);
 			exit(EXIT_FAILURE);
 		}
-		else t_option = TRUE;
+	}
+	if (e_option && p_option > 0) {
+		fprintf(stderr, "%s\n", WRONG_PAR);
+		fprintf(stderr, "%s\n", SR_RIGHT_WAY);
+		exit(EXIT_FAILURE);
 	}
 	
 	
@@ -1246,19 +2523,32 @@ int main(int argc, char **argv)
 	if (t_option) {
 		fprintf(stdout, "%s\n", TESTMODE);
 	}
+	seed_base = baseSeed(t_option);
+	if (!t_option) fprintf(stdout, SEED_BASE, (unsigned long long)seed_base);
 	
 	/* Apertura del file degli utenti e popolazione dell'albero */
 	ec_null ( utenti_r = fopen(argv[1], "r") )
-	ec_neg1 ( n_users = loadUsers(utenti_r, &generalTree) )
+	ec_neg1 ( n_users = loadUsersDb(utenti_r, &usersDb) )
 	fprintf(stdout, LOADED, n_users, argv[1]);
 	ec_eof ( fclose(utenti_r) )
 	utenti_r = NULL;
 	
+	/* Riapplicazione delle operazioni successive all'ultima compattazione ed apertura del journal */
+	users_file = argv[1];
+	ec_null ( journal_file = (char*)malloc(strlen(argv[1]) + strlen(JOURNAL_SUFFIX) + 1) )
+	sprintf(journal_file, "%s%s", argv[1], JOURNAL_SUFFIX);
+	ec_neg1 ( n_ops = journalOpen(&journal, journal_file, &usersDb) )
+	fprintf(stdout, REPLAYED, n_ops, journal_file);
+	
+	/* Allocazione della tabella dei buffer di ricezione (una entry per ogni possibile file descriptor) */
+	ec_neg1 ( conn_max = sysconf(_SC_OPEN_MAX) )
+	ec_null ( conn_rbuf = (rbuf_t**)calloc(conn_max, sizeof(rbuf_t*)) )
+	
 	/* Apertura della socket per l'accettazione delle connessioni */
 	ec_neg1 ( socket_desc = createServerChannel(SOCKNAME) )
 	
-	/* Avvio del thread Signaler e del thread Dispatcher */
-	ec_nzero ( err = pthread_create(&dispatch, NULL, &Dispatcher, &socket_desc) )
+	/* Avvio del thread Signaler e del thread Dispatcher (o Reactor, con l'opzione -e) */
+	ec_nzero ( err = pthread_create(&dispatch, NULL, e_option ? &Reactor : &Dispatcher, &socket_desc) )
 	ec_nzero ( err = pthread_create(&signaler, NULL, &Signaler, &dispatch) )
 	
 	/* Attesa della terminazione dei thread */
@@ -1270,13 +2560,15 @@ int main(int argc, char **argv)
 	/* Chiusura della socket */
 	ec_neg1 ( closeServerChannel(SOCKNAME, socket_desc) )
 	
-	/* Aggiornamento file utenti */
-	ec_null ( utenti_r = fopen(argv[1], "w") )
-	ec_neg1 ( n_users = storeUsers(utenti_r, generalTree) )
+	/* Aggiornamento file utenti (compattazione finale del journal) */
+	ec_neg1 ( n_users = journalCompact(&journal, &usersDb, argv[1]) )
 	fprintf(stdout, SAVED, n_users, argv[1]);
-	ec_eof ( fclose(utenti_r) )
+	journalClose(&journal);
+	free(journal_file);
 	
-	freeTree(generalTree);
+	if (lobby_cache != NULL) ReleasePayload(lobby_cache);
+	freeUserDb(&usersDb);
+	free(conn_rbuf);
 	return 0;
 	
 	EC_CLEANUP_BGN
@@ -1289,7 +2581,11 @@ int main(int argc, char **argv)
 		if (utenti_r != NULL)
 			fclose(utenti_r);
 		
-		freeTree(generalTree);
+		journalClose(&journal);
+		if (journal_file != NULL) free(journal_file);
+		if (lobby_cache != NULL) ReleasePayload(lobby_cache);
+		freeUserDb(&usersDb);
+		if (conn_rbuf != NULL) free(conn_rbuf);
 		
 		if (socket_desc != -1)
 			closeServerChannel(SOCKNAME, socket_desc);
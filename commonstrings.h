@@ -16,10 +16,14 @@
 #define SOCKNAME "./tmp/briscola.skt"
 /** Pathname per il file checkpoint */
 #define CP_NAME "./brs.checkpoint"
+/** Pathname del file temporaneo in cui viene scritto il checkpoint */
+#define CP_TMP "./brs.checkpoint.tmp"
 /** Template per il nome dei file di log (prefisso) */
 #define LOG_NAME_ST "./BRS-"
 /** Template per il nome dei file di log (suffisso) */
 #define LOG_NAME_END ".log"
+/** Suffisso del nome del journal (aggiunto al nome del file degli utenti) */
+#define JOURNAL_SUFFIX ".journal"
 /* Opzioni */
 /** Modalità server test */
 #define TEST_OPTN "-t"
@@ -29,24 +33,36 @@
 #define CANC_OPTN "-c"
 /** Disconnessione forzata */
 #define DISC_OPTN "-d"
+/** Modalità server ad eventi (epoll) */
+#define EPOLL_OPTN "-e"
+/** Modalità server con pool di thread (seguita dal numero di thread) */
+#define POOL_OPTN "-p"
+/** Connessione con una pagina della lista degli utenti in attesa (seguita da offset, numero di utenti ed eventuale prefisso) */
+#define LOBBY_OPTN "-l"
 /** Messaggio di attesa */
 #define WAIT_MSG "WAIT"
 
 /* Definizione macro per stringhe */
 
 /** Corretto utilizzo del server */
-#define SR_RIGHT_WAY "Uso:\tbrsserver file_utenti [-t]"
+#define SR_RIGHT_WAY "Uso:\tbrsserver file_utenti [-t] [-e | -p n_thread]\n" \
+	"\t-p n_thread: ogni thread del pool serve un client alla volta per tutta la sessione (fino alla fine\n" \
+	"\tdella partita); un client che non invia nulla per 60 secondi viene disconnesso"
 /** Non è stata fornita una lista di utenti */
 #define NO_USRLIST "Errore: devi fornire la lista utenti"
 /** Troppi parametri */
 #define TOO_MANY_PAR "Errore: troppi parametri"
 /** Parametro non corretto */
-#define WRONG_PAR "Errore: secondo parametro non corretto"
+#define WRONG_PAR "Errore: parametro non corretto"
 
 /** Il server è in modalità test */
 #define TESTMODE "-- MODALITA' TEST ATTIVA --"
 /** Numero di utenti caricati */
 #define LOADED "Caricati %d utenti dal file %s \n"
+/** Numero di operazioni riapplicate dal journal */
+#define REPLAYED "Riapplicate %d operazioni dal journal %s \n"
+/** Seme base delle partite (fuori dalla modalità test) */
+#define SEED_BASE "Seme delle partite: %llu + numero della partita\n"
 /** Il server è in chiusura */
 #define CLOSING "Chiusura..."
 /** Numero di utenti salvati */
@@ -68,6 +84,10 @@
 #define ALR_CONN "Utente già connesso"
 /** Funzionalità non supportata */
 #define NOT_SUPPORTED "Non supportato al momento"
+/** Server sovraccarico (coda del pool piena) */
+#define SERVER_BUSY "Server occupato, riprovare piu' tardi"
+/** Richiesta di una pagina della lista degli utenti in attesa non valida */
+#define PAGE_ERR "Richiesta di pagina della lista utenti non valida"
 /** La carta giocata dall'utente non è presente nella sua mano */
 #define NOT_IN_DECK "La carta giocata non e' presente nella mano"
 /** La stringa inserita dall'utente non corrisponde a una carta */
@@ -77,6 +97,8 @@
 
 /** Prima riga del file di log */
 #define FIRST_LOG "%s:%s\nBRISCOLA:%c\n"
+/** Riga del file di log con il seme della partita (fuori dalla modalità test) */
+#define SEED_LOG "SEED:%llu\n"
 /** Ultima riga del file di log */
 #define LAST_LOG "WINS:%s\nPOINTS:%s\n"
 
@@ -86,6 +108,10 @@
 #define TERM_SIGTERM "SIGTERM -- Terminazione..."
 /** Segnale SIGUSR1 ricevuto */
 #define CHECK_SIGUSR1 "SIGUSR1 -- Stampa dell'albero su file di checkpoint completata"
+/** Scrittura del checkpoint fallita */
+#define CHECK_FAILED "SIGUSR1 -- Scrittura del file di checkpoint non riuscita"
+/** Statistiche della lista degli utenti in attesa in cache */
+#define CACHE_STATS "Lista utenti in attesa: %lu connessioni servite dalla cache, %lu ricostruzioni\n"
 
 /* Client */
 
@@ -93,7 +119,7 @@
 #define SERVER_KILLED "Errore: il server e' stato terminato o lo sfidante si e' disconnesso\nUscita in corso"
 
 /** Utilizzo del programma */
-#define CL_RIGHT_WAY "Uso:\tbrsclient username password [-r | -c | -d]"
+#define CL_RIGHT_WAY "Uso:\tbrsclient username password [-r | -c | -d | -l offset n_utenti [prefisso]]"
 /** Numero di argomenti da linea di comando non valido */
 #define WR_NUMB_OF_ARGS "Errore: numero di argomenti non valido"
 /** Opzione non riconosciuta */
@@ -13,8 +13,10 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/stat.h>
 #include <sys/un.h>
 #include "comsock.h"
@@ -45,10 +47,10 @@ static void intToChar (unsigned int n, char* container)
 static unsigned int charToInt(char buffer[]) 
 {
 	unsigned int n,
-		n1 = buffer[3],
-		n2 = buffer[2],
-		n3 = buffer[1],
-		n4 = buffer[0];
+		n1 = (unsigned char)buffer[3],
+		n2 = (unsigned char)buffer[2],
+		n3 = (unsigned char)buffer[1],
+		n4 = (unsigned char)buffer[0];
 		
 	n = n1 + (n2 << 8) + (n3 << 16) + (n4 << 24);
 	return n;
@@ -119,91 +121,361 @@ int acceptConnection(int s)
 	return c;
 }
 
+/** Legge esattamente \c n byte dalla socket, ripetendo la \c read in caso di letture parziali
+ * 
+ * \param sc file descriptor della socket
+ * \param buf area in cui memorizzare i byte letti
+ * \param n numero di byte da leggere
+ * 
+ * \retval 0 se sono stati letti tutti gli \c n byte
+ * \retval -1 in caso di errore (setta \c errno, \c ENOTCONN se il peer ha chiuso la connessione)
+ *
+ */
+
+static int readAll(int sc, char* buf, unsigned int n)
+{
+	unsigned int got = 0;
+	int r;
+	
+	while (got < n) {
+		switch (r = read(sc, buf+got, n-got)) {
+			case -1:
+				if (errno == EINTR) continue;
+				return -1;
+			case 0:
+				errno = ENOTCONN;
+				return -1;
+			default:
+				got += r;
+				break;
+		}
+	}
+	return 0;
+}
+
 int receiveMessage(int sc, message_t * msg)
 {
-	unsigned int r_type, r_size, r_buff, lung;
-	char t, buflen[4];
+	unsigned int r_buff;
+	char header[MSG_HEADER];
 	char* text = NULL;
 	
-	switch (r_type = read(sc, &t, 1)) {
-		case -1:
-			return -1;
-		case 0:
-			errno = ENOTCONN;
+	if (readAll(sc, header, MSG_HEADER) == -1)
+		return -1;
+	
+	r_buff = charToInt(header+1);
+	
+	if (r_buff > 0) {
+		text = (char*)malloc(r_buff*sizeof(char));
+		if (text == NULL) return -1;
+		
+		if (readAll(sc, text, r_buff) == -1) {
+			free(text);
 			return -1;
-		case 1:
-			break;
-		default:
+		}
+		msg->type = header[0];
+		msg->length = r_buff;
+		msg->buffer = text;
+	}
+	else {
+		msg->type = header[0];
+		msg->length = 0;
+		msg->buffer = NULL;
+	}
+	
+	return r_buff;
+}
+
+rbuf_t* createRecvBuffer(int sc)
+{
+	rbuf_t* rb = NULL;
+	
+	if ((rb = (rbuf_t*)malloc(sizeof(rbuf_t))) == NULL)
+		return NULL;
+	if ((rb->data = (char*)malloc(RBUF_SIZE*sizeof(char))) == NULL) {
+		free(rb);
+		return NULL;
+	}
+	rb->fd = sc;
+	rb->start = 0;
+	rb->end = 0;
+	rb->size = RBUF_SIZE;
+	return rb;
+}
+
+void freeRecvBuffer(rbuf_t* rb)
+{
+	if (rb != NULL) {
+		free(rb->data);
+		free(rb);
+	}
+}
+
+int fillRecvBuffer(rbuf_t* rb)
+{
+	unsigned int pending, needed = 0;
+	int r;
+	
+	/* Compattazione: i byte non ancora consumati vengono spostati in testa */
+	pending = rb->end - rb->start;
+	if (rb->start > 0) {
+		memmove(rb->data, rb->data + rb->start, pending);
+		rb->start = 0;
+		rb->end = pending;
+	}
+	
+	/* Se l'header è completo e il messaggio non entra nel buffer, il buffer viene ingrandito */
+	if (pending >= MSG_HEADER)
+		needed = MSG_HEADER + charToInt(rb->data+1);
+	if (needed > rb->size) {
+		char* bigger = NULL;
+		if ((bigger = (char*)realloc(rb->data, needed*sizeof(char))) == NULL)
 			return -1;
+		rb->data = bigger;
+		rb->size = needed;
 	}
 	
-	switch (r_size = read(sc, buflen, 4)) {
+	do {
+		r = read(rb->fd, rb->data + rb->end, rb->size - rb->end);
+	} while (r == -1 && errno == EINTR);
+	
+	switch (r) {
 		case -1:
 			return -1;
 		case 0:
 			errno = ENOTCONN;
 			return -1;
-		case 4:
-			break;
 		default:
-			return -1;
+			rb->end += r;
+			break;
 	}
+	return r;
+}
+
+int extractMessage(rbuf_t* rb, message_t* msg)
+{
+	unsigned int r_buff, pending;
+	char* text = NULL;
 	
-	r_buff = charToInt(buflen);
+	pending = rb->end - rb->start;
+	if (pending < MSG_HEADER) {
+		errno = EAGAIN;
+		return -1;
+	}
+	r_buff = charToInt(rb->data + rb->start + 1);
+	if (pending - MSG_HEADER < r_buff) {
+		errno = EAGAIN;
+		return -1;
+	}
 	
 	if (r_buff > 0) {
-		text = (char*)malloc(r_buff*sizeof(char));
-		if (text == NULL) return -1;
-		
-		switch (lung = read(sc, text, r_buff)) {
+		if ((text = (char*)malloc(r_buff*sizeof(char))) == NULL)
+			return -1;
+		memcpy(text, rb->data + rb->start + MSG_HEADER, r_buff);
+	}
+	msg->type = rb->data[rb->start];
+	msg->length = r_buff;
+	msg->buffer = text;
+	
+	rb->start += MSG_HEADER + r_buff;
+	if (rb->start == rb->end) {
+		rb->start = 0;
+		rb->end = 0;
+	}
+	return r_buff;
+}
+
+int receiveMessageBuf(rbuf_t* rb, message_t* msg)
+{
+	int r;
+	
+	while ((r = extractMessage(rb, msg)) == -1) {
+		if (errno != EAGAIN) return -1;
+		if (fillRecvBuffer(rb) == -1) return -1;
+	}
+	return r;
+}
+
+/** Scrive sulla socket tutti i byte descritti da un vettore di \c iovec, ripetendo la \c writev
+ *  in caso di scritture parziali
+ * 
+ * \param sc file descriptor della socket
+ * \param iov vettore dei segmenti da scrivere (viene modificato dalla funzione)
+ * \param cnt numero di segmenti
+ * 
+ * \retval n numero totale di byte scritti
+ * \retval -1 in caso di errore (setta \c errno, \c ENOTCONN se il peer ha chiuso la connessione)
+ *
+ */
+
+static int writevAll(int sc, struct iovec* iov, int cnt)
+{
+	int n, total = 0;
+	
+	while (cnt > 0) {
+		/* I segmenti vuoti in testa vengono saltati */
+		if (iov->iov_len == 0) {
+			iov++;
+			cnt--;
+			continue;
+		}
+		switch (n = writev(sc, iov, cnt)) {
 			case -1:
+				if (errno == EINTR) continue;
 				return -1;
 			case 0:
 				errno = ENOTCONN;
 				return -1;
 			default:
+				total += n;
 				break;
 		}
-		msg->type = t;
-		msg->length = lung;
-		msg->buffer = text;
-	}
-	else {
-		msg->type = t;
-		msg->length = 0;
-		msg->buffer = NULL;
+		/* Scrittura parziale: si avanza sui segmenti già inviati */
+		while (cnt > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt > 0) {
+			iov->iov_base = (char*)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
 	}
-	
-	return r_buff;
+	return total;
 }
 
 int sendMessage(int sc, message_t *msg)
 {	
-	int i, n, size;
-	char *receiver = NULL, intcontainer[4];
-	if ((receiver = (char*)malloc((5+(msg->length))*sizeof(char))) == NULL)
-		return -1;
-	intToChar(msg->length, intcontainer);
+	char header[MSG_HEADER];
+	struct iovec iov[2];
 	
-	receiver[0] = msg->type;
-	for (i = 0; i<4; i++) receiver[i+1] = intcontainer[i];
-	strncpy((receiver+5), msg->buffer, msg->length);
-	size = msg->length + 5;
+	header[0] = msg->type;
+	intToChar(msg->length, header+1);
+	iov[0].iov_base = header;
+	iov[0].iov_len = MSG_HEADER;
+	iov[1].iov_base = msg->buffer;
+	iov[1].iov_len = (msg->buffer != NULL) ? msg->length : 0;
 	
-	switch(n = write(sc, receiver, size)) {
-		case -1:
-			free(receiver);
-			return -1;
-		case 0:
-			free(receiver);
-			errno = ENOTCONN;
+	return writevAll(sc, iov, 2);
+}
+
+int sendMessages(int sc, message_t *msgs, int n)
+{
+	char headers[MAXBATCH][MSG_HEADER];
+	struct iovec iov[2*MAXBATCH];
+	int i, k, sent, total = 0;
+	
+	if (n < 0 || (n > 0 && msgs == NULL)) {
+		errno = EINVAL;
+		return -1;
+	}
+	
+	for (i = 0; i < n; i += k) {
+		for (k = 0; k < MAXBATCH && i+k < n; k++) {
+			headers[k][0] = msgs[i+k].type;
+			intToChar(msgs[i+k].length, headers[k]+1);
+			iov[2*k].iov_base = headers[k];
+			iov[2*k].iov_len = MSG_HEADER;
+			iov[2*k+1].iov_base = msgs[i+k].buffer;
+			iov[2*k+1].iov_len = (msgs[i+k].buffer != NULL) ? msgs[i+k].length : 0;
+		}
+		if ((sent = writevAll(sc, iov, 2*k)) == -1)
 			return -1;
-		default:
-			break;
+		total += sent;
+	}
+	return total;
+}
+
+int setNonBlocking(int sc)
+{
+	int flags;
+	
+	if ((flags = fcntl(sc, F_GETFL)) == -1)
+		return -1;
+	if (fcntl(sc, F_SETFL, flags | O_NONBLOCK) == -1)
+		return -1;
+	return 0;
+}
+
+sbuf_t* createSendBuffer(int sc)
+{
+	sbuf_t* sb = NULL;
+	
+	if ((sb = (sbuf_t*)malloc(sizeof(sbuf_t))) == NULL)
+		return NULL;
+	if ((sb->data = (char*)malloc(RBUF_SIZE*sizeof(char))) == NULL) {
+		free(sb);
+		return NULL;
 	}
+	sb->fd = sc;
+	sb->start = 0;
+	sb->end = 0;
+	sb->size = RBUF_SIZE;
+	return sb;
+}
+
+void freeSendBuffer(sbuf_t* sb)
+{
+	if (sb != NULL) {
+		free(sb->data);
+		free(sb);
+	}
+}
+
+int queueMessage(sbuf_t* sb, message_t* msg)
+{
+	unsigned int len, pending;
 	
-	free(receiver);
-	return n;
+	len = MSG_HEADER + ((msg->buffer != NULL) ? msg->length : 0);
+	pending = sb->end - sb->start;
+	
+	/* Compattazione ed eventuale ingrandimento del buffer */
+	if (sb->size - sb->end < len) {
+		if (sb->start > 0) {
+			memmove(sb->data, sb->data + sb->start, pending);
+			sb->start = 0;
+			sb->end = pending;
+		}
+		if (sb->size - sb->end < len) {
+			char* bigger = NULL;
+			unsigned int newsize = sb->size;
+			while (newsize - pending < len) newsize *= 2;
+			if ((bigger = (char*)realloc(sb->data, newsize*sizeof(char))) == NULL)
+				return -1;
+			sb->data = bigger;
+			sb->size = newsize;
+		}
+	}
+	
+	sb->data[sb->end] = msg->type;
+	intToChar((msg->buffer != NULL) ? msg->length : 0, sb->data + sb->end + 1);
+	if (msg->buffer != NULL)
+		memcpy(sb->data + sb->end + MSG_HEADER, msg->buffer, msg->length);
+	sb->end += len;
+	return 0;
+}
+
+int flushSendBuffer(sbuf_t* sb)
+{
+	int n;
+	
+	while (sb->start < sb->end) {
+		switch (n = write(sb->fd, sb->data + sb->start, sb->end - sb->start)) {
+			case -1:
+				if (errno == EINTR) continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					return sb->end - sb->start;
+				return -1;
+			case 0:
+				errno = ENOTCONN;
+				return -1;
+			default:
+				sb->start += n;
+				break;
+		}
+	}
+	sb->start = 0;
+	sb->end = 0;
+	return 0;
 }
 
 int openConnection(char* path, int ntrial, int k)
@@ -34,6 +34,64 @@ typedef struct {
     char *buffer;        
 } message_t; 
 
+/** <H3>Buffer di ricezione</H3>
+ * La struttura \c rbuf_t rappresenta il buffer di ricezione associato a una connessione:
+ * ogni \c read preleva dal kernel tutti i byte disponibili (fino alla capacità del buffer), da cui
+ * vengono poi estratti i messaggi completi senza ulteriori chiamate di sistema
+ * - \c fd file descriptor della connessione
+ * - \c start indice del primo byte non ancora consumato
+ * - \c end indice successivo all'ultimo byte ricevuto
+ * - \c size capacità del buffer
+ * - \c data area dati del buffer
+ *
+ * <HR>
+ */
+typedef struct {
+  /** File descriptor della connessione */
+    int fd;
+  /** Primo byte non ancora consumato */
+    unsigned int start;
+  /** Fine dei dati ricevuti */
+    unsigned int end;
+  /** Capacità del buffer */
+    unsigned int size;
+  /** Dati ricevuti */
+    char *data;
+} rbuf_t;
+
+/** <H3>Buffer di invio</H3>
+ * La struttura \c sbuf_t rappresenta il buffer di invio associato a una connessione non bloccante:
+ * i messaggi vengono accodati già serializzati e trasmessi quando la socket è pronta in scrittura
+ * - \c fd file descriptor della connessione
+ * - \c start indice del primo byte non ancora inviato
+ * - \c end indice successivo all'ultimo byte accodato
+ * - \c size capacità del buffer
+ * - \c data area dati del buffer
+ *
+ * <HR>
+ */
+typedef struct {
+  /** File descriptor della connessione */
+    int fd;
+  /** Primo byte non ancora inviato */
+    unsigned int start;
+  /** Fine dei dati accodati */
+    unsigned int end;
+  /** Capacità del buffer */
+    unsigned int size;
+  /** Dati da inviare */
+    char *data;
+} sbuf_t;
+
+/** Lunghezza dell'header di un messaggio (tipo + lunghezza) */
+#define MSG_HEADER 5
+
+/** Capacità iniziale del buffer di ricezione */
+#define RBUF_SIZE 4096
+
+/** Massimo numero di messaggi serializzati in una singola \c writev dalla \c sendMessages */
+#define MAXBATCH 16
+
 /** Lunghezza buffer indirizzo \c AF_UNIX */
 #define UNIX_PATH_MAX    108
 
@@ -73,6 +131,9 @@ typedef struct {
 #define MSG_PLAY      'P' 
 /** Messaggio di comunicazione nuova carta */
 #define MSG_CARD      'A' 
+/** Messaggio di richiesta di connessione al servizio con una pagina della lista degli utenti in attesa
+    (\c offset:n_utenti:prefisso:username:password; alla risposta si applicano le regole di \c MSG_CONNECT) */
+#define MSG_LOBBY      'L' 
 
 
 /* -= FUNZIONI =- */
@@ -123,9 +184,58 @@ int acceptConnection(int s);
  */
 int receiveMessage(int sc, message_t * msg);
 
+/** Crea il buffer di ricezione di una connessione
+ *  \param sc file descriptor della socket
+ *
+ *  \retval rb   puntatore al nuovo buffer
+ *  \retval NULL in caso di errore (setta \c errno)
+ */
+rbuf_t* createRecvBuffer(int sc);
+
+/** Dealloca il buffer di ricezione di una connessione (non chiude la socket)
+ *  \param rb buffer da deallocare
+ */
+void freeRecvBuffer(rbuf_t* rb);
+
+/** Effettua una singola \c read sulla socket del buffer, accodando tutti i byte disponibili
+ *  \param rb buffer di ricezione
+ *
+ *  \retval n    numero di byte letti
+ *  \retval -1   in caso di errore (setta \c errno)
+ *                 \c errno = \c ENOTCONN se il peer ha chiuso la connessione
+ *                 \c errno = \c EAGAIN se la socket è non bloccante e non ci sono dati
+ *
+ *  \note se il messaggio in testa al buffer eccede la capacità del buffer, quest'ultimo viene ingrandito
+ */
+int fillRecvBuffer(rbuf_t* rb);
+
+/** Estrae dal buffer il primo messaggio completo, senza effettuare chiamate di sistema
+ *  \param rb  buffer di ricezione
+ *  \param msg indirizzo della struttura che conterra' il messaggio (il campo \c buffer è allocato all'interno della funzione)
+ *
+ *  \retval lung lunghezza del buffer del messaggio estratto
+ *  \retval -1   in caso di errore (setta \c errno)
+ *                 \c errno = \c EAGAIN se il buffer non contiene un messaggio completo
+ */
+int extractMessage(rbuf_t* rb, message_t* msg);
+
+/** Legge un messaggio dalla connessione associata al buffer, effettuando tante \c read quante
+ *  sono necessarie a completarlo (nessuna, se il messaggio era già stato ricevuto)
+ *  \param rb  buffer di ricezione
+ *  \param msg indirizzo della struttura che conterra' il messaggio letto
+ *
+ *  \retval lung lunghezza del buffer letto, se l'operazione è andata a buon fine
+ *  \retval -1   in caso di errore (setta \c errno)
+ *                 \c errno = \c ENOTCONN se il peer ha chiuso la connessione
+ *
+ *  \note ha la stessa semantica della \c receiveMessage, ma i byte in eccesso rispetto al messaggio
+ *  restituito restano nel buffer e sono usati dalle chiamate successive
+ */
+int receiveMessageBuf(rbuf_t* rb, message_t* msg);
+
 /** Scrive un messaggio sulla socket 
- *  \note Sono inviati \b solo i byte significativi del campo \c buffer (\c msg->length byte) - il messaggio è impacchettato
- * 		  in modo da garantire l'atomicità della \c write
+ *  \note Sono inviati \b solo i byte significativi del campo \c buffer (\c msg->length byte) - header e buffer sono
+ * 		  passati al kernel con un'unica \c writev, ripetuta finché il messaggio non è stato scritto per intero
  * 	
  *   \param  sc file descriptor della socket
  *   \param msg indirizzo della struttura che contiene il messaggio da scrivere 
@@ -136,13 +246,66 @@ int receiveMessage(int sc, message_t * msg);
  *                   (non ci sono piu' lettori sulla socket)
  * 
  * 	 \section commagg1 Commenti Aggiuntivi
- * 	 Il messaggio viene incapsulato in una struttura di tipo \c char* secondo questa logica: in posizione 0
- * 	 si trova il carattere che contraddistingue il tipo di messaggio (campo \c type della struttura message_t);
- * 	 nelle posizioni 1-4 si trovano i byte in cui è stato convertito il campo \c length (mediante la intToChar); infine,
- * 	 se \c msg.length > 0, nelle posizioni da 5 a \c msg.length+4 è memorizzato il campo \c buffer.
+ * 	 Il messaggio viene trasmesso secondo questa logica: nel byte 0 si trova il carattere che contraddistingue il tipo
+ * 	 di messaggio (campo \c type della struttura message_t); nei byte 1-4 si trovano i byte in cui è stato convertito
+ * 	 il campo \c length (mediante la intToChar); infine, se \c msg.length > 0, nei byte da 5 a \c msg.length+4 si trova
+ * 	 il campo \c buffer. L'header è costruito sullo stack e il buffer non viene copiato: la funzione non alloca memoria.
  */
 int sendMessage(int sc, message_t *msg);
 
+/** Scrive una sequenza di messaggi sulla socket, serializzandoli in un'unica \c writev
+ *  \note Il formato di ogni messaggio è quello descritto nella \c sendMessage; se \c n eccede \c MAXBATCH
+ *  i messaggi sono inviati a blocchi di \c MAXBATCH
+ * 
+ *   \param  sc file descriptor della socket
+ *   \param msgs array dei messaggi da scrivere, nell'ordine di invio
+ *   \param n numero di messaggi
+ *   
+ *   \retval  n    il numero complessivo di caratteri inviati, se la scrittura è andata a buon fine
+ *   \retval -1   in caso di errore (setta \c errno)
+ *                 \c errno = \c ENOTCONN se il peer ha chiuso la connessione
+ */
+int sendMessages(int sc, message_t *msgs, int n);
+
+/** Imposta una socket in modalità non bloccante
+ *   \param sc file descriptor della socket
+ *
+ *   \retval 0  se tutto ok
+ *   \retval -1 se errore (setta \c errno)
+ */
+int setNonBlocking(int sc);
+
+/** Crea il buffer di invio di una connessione
+ *  \param sc file descriptor della socket
+ *
+ *  \retval sb   puntatore al nuovo buffer
+ *  \retval NULL in caso di errore (setta \c errno)
+ */
+sbuf_t* createSendBuffer(int sc);
+
+/** Dealloca il buffer di invio di una connessione (non chiude la socket, i dati non inviati vengono persi)
+ *  \param sb buffer da deallocare
+ */
+void freeSendBuffer(sbuf_t* sb);
+
+/** Accoda un messaggio al buffer di invio, nel formato descritto nella \c sendMessage (non effettua chiamate di sistema)
+ *  \param sb  buffer di invio
+ *  \param msg messaggio da accodare
+ *
+ *  \retval 0  se tutto ok
+ *  \retval -1 se errore (setta \c errno)
+ */
+int queueMessage(sbuf_t* sb, message_t* msg);
+
+/** Invia sulla socket quanti più byte accodati possibile, fermandosi se la socket non bloccante non è pronta
+ *  \param sb buffer di invio
+ *
+ *  \retval n  numero di byte ancora da inviare (0 se il buffer è stato svuotato)
+ *  \retval -1 in caso di errore (setta \c errno)
+ *               \c errno = \c ENOTCONN se il peer ha chiuso la connessione
+ */
+int flushSendBuffer(sbuf_t* sb);
+
 /** Crea una connessione alla socket del server. In caso di errore, ritenta \c ntrial volte la connessione (a distanza di \c k secondi l'una dall'altra) prima di ritornare errore.
  *   \param  path  nome della socket su cui il server accetta le connessioni
  *   \param  ntrial numeri di tentativi prima di restituire errore (\c ntrial <= \c MAXTRIAL)
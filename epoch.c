@@ -0,0 +1,175 @@
+/**
+ *  \file epoch.c
+ *  \author Orlando Leombruni
+ *
+ *  \brief Implementazione del recupero della memoria basato su epoche.
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include "epoch.h"
+
+/** Stato di un thread lettore */
+typedef struct reader {
+	/** Epoca osservata all'ingresso nella sezione, moltiplicata per 2, piu' 1 se il thread e' in una sezione (0 altrimenti) */
+	unsigned long state;
+	/** 1 se il descrittore e' assegnato ad un thread, 0 se puo' essere riusato */
+	int inuse;
+	/** Descrittore successivo */
+	struct reader* next;
+} reader_t;
+
+/** Oggetto ritirato in attesa del periodo di grazia */
+typedef struct retired {
+	/** Oggetto */
+	void* p;
+	/** Funzione di deallocazione */
+	void (*fn)(void*);
+	/** Epoca globale al momento del ritiro */
+	unsigned long epoch;
+	/** Oggetto successivo */
+	struct retired* next;
+} retired_t;
+
+/** Epoca globale */
+static unsigned long global_epoch = 0;
+/** Lista dei descrittori dei lettori: cresce solo con inserimenti in testa e i descrittori
+    dei thread terminati vengono riusati, per cui puo' essere percorsa senza lock */
+static reader_t* readers = NULL;
+/** Chiave del descrittore del thread chiamante */
+static pthread_key_t reader_key;
+/** Creazione della chiave */
+static pthread_once_t reader_once = PTHREAD_ONCE_INIT;
+/** Esito della creazione della chiave */
+static int reader_err = 0;
+/** Oggetti ritirati, dal piu' recente */
+static retired_t* retired = NULL;
+/** Mutex sulla lista degli oggetti ritirati e sull'avanzamento dell'epoca */
+static pthread_mutex_t retire_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** Rende riusabile il descrittore di un thread che termina */
+static void releaseReader(void* r) {
+	__atomic_store_n(&(((reader_t*)r)->state), 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&(((reader_t*)r)->inuse), 0, __ATOMIC_RELEASE);
+}
+
+/** Crea la chiave dei descrittori */
+static void createKey(void) {
+	reader_err = pthread_key_create(&reader_key, releaseReader);
+}
+
+/** Restituisce il descrittore del thread chiamante, assegnandogliene uno alla prima chiamata;
+    restituisce \c NULL se si e' verificato un errore (setta \c errno) */
+static reader_t* getReader(void) {
+	reader_t* r = NULL;
+	int unused = 0;
+	if ((errno = pthread_once(&reader_once, createKey)) != 0) return NULL;
+	if ((errno = reader_err) != 0) return NULL;
+	if ((r = (reader_t*)pthread_getspecific(reader_key)) != NULL) return r;
+	/* Riuso del descrittore di un thread terminato */
+	for (r = __atomic_load_n(&readers, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+		unused = 0;
+		if (__atomic_compare_exchange_n(&(r->inuse), &unused, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) break;
+	}
+	if (r == NULL) {
+		if ((r = (reader_t*)malloc(sizeof(reader_t))) == NULL) return NULL;
+		r->state = 0;
+		r->inuse = 1;
+		r->next = __atomic_load_n(&readers, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&readers, &(r->next), r, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	}
+	if ((errno = pthread_setspecific(reader_key, r)) != 0) {
+		releaseReader(r);
+		return NULL;
+	}
+	return r;
+}
+
+int epochEnter(void) {
+	reader_t* r = NULL;
+	if ((r = getReader()) == NULL) return -1;
+	__atomic_store_n(&(r->state), (__atomic_load_n(&global_epoch, __ATOMIC_RELAXED) << 1) | 1, __ATOMIC_RELAXED);
+	/* L'annuncio deve essere visibile prima di qualsiasi lettura della sezione: un thread che
+	   non lo vede durante l'avanzamento dell'epoca ha reso irraggiungibili i propri oggetti
+	   prima di queste letture */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return 0;
+}
+
+void epochExit(void) {
+	reader_t* r = (reader_t*)pthread_getspecific(reader_key);
+	if (r != NULL) __atomic_store_n(&(r->state), 0, __ATOMIC_RELEASE);
+}
+
+/** Fa avanzare l'epoca globale se tutti i lettori attivi l'hanno osservata e stacca dalla lista
+    gli oggetti il cui periodo di grazia e' terminato, restituendoli (va chiamata in mutua
+    esclusione su \c retire_mutex) */
+static retired_t* advance(void) {
+	reader_t* r = NULL;
+	retired_t **p = &retired, *done = NULL;
+	unsigned long e, s;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	e = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+	for (r = __atomic_load_n(&readers, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+		s = __atomic_load_n(&(r->state), __ATOMIC_ACQUIRE);
+		if ((s & 1) && (s >> 1) != e) break;
+	}
+	if (r == NULL) __atomic_store_n(&global_epoch, ++e, __ATOMIC_SEQ_CST);
+	/* La lista e' ordinata per epoca decrescente */
+	while ((*p) != NULL && (*p)->epoch + 2 > e) p = &((*p)->next);
+	done = (*p);
+	(*p) = NULL;
+	return done;
+}
+
+/** Chiama le funzioni di deallocazione di una lista di oggetti ritirati */
+static void reclaimList(retired_t* l) {
+	retired_t* next = NULL;
+	for (; l != NULL; l = next) {
+		next = l->next;
+		l->fn(l->p);
+		free(l);
+	}
+}
+
+void epochRetire(void* p, void (*fn)(void*)) {
+	retired_t *new = NULL, *done = NULL;
+	if ((new = (retired_t*)malloc(sizeof(retired_t))) == NULL) {
+		epochBarrier();
+		fn(p);
+		return;
+	}
+	new->p = p;
+	new->fn = fn;
+	pthread_mutex_lock(&retire_mutex);
+	new->epoch = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+	new->next = retired;
+	retired = new;
+	done = advance();
+	pthread_mutex_unlock(&retire_mutex);
+	reclaimList(done);
+}
+
+void epochReclaim(void) {
+	retired_t* done = NULL;
+	pthread_mutex_lock(&retire_mutex);
+	done = advance();
+	pthread_mutex_unlock(&retire_mutex);
+	reclaimList(done);
+}
+
+void epochBarrier(void) {
+	unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+	while (1) {
+		epochReclaim();
+		if (__atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE) >= e + 2) break;
+		sched_yield();
+	}
+	/* Gli oggetti ritirati prima della chiamata hanno epoca al piu' e */
+	epochReclaim();
+}
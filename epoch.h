@@ -0,0 +1,52 @@
+/**
+ *  \file epoch.h
+ *  \author Orlando Leombruni
+ *
+ *  \brief Recupero della memoria basato su epoche, per strutture lette senza lock.
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ */
+
+#ifndef __EPOCH__H
+#define __EPOCH__H
+
+/** Un thread lettore racchiude ogni accesso senza lock a una struttura condivisa fra
+    \c epochEnter ed \c epochExit (sezioni non annidate). Chi modifica la struttura, dopo
+    aver reso irraggiungibile un oggetto, lo consegna a \c epochRetire anziche' deallocarlo:
+    l'oggetto viene deallocato solo quando tutti i lettori che potevano vederlo sono usciti
+    dalla propria sezione (periodo di grazia).
+
+    L'epoca globale avanza solo quando tutti i lettori attivi l'hanno osservata; un oggetto
+    ritirato nell'epoca \c e puo' quindi essere deallocato quando l'epoca globale vale
+    almeno <tt>e+2</tt>. Le funzioni di deallocazione sono eseguite da \c epochRetire,
+    \c epochReclaim ed \c epochBarrier, nel thread che le chiama. */
+
+/** Inizio di una sezione di lettura del thread chiamante (che alla prima chiamata viene registrato).
+
+ \retval 0 se tutto ok
+ \retval -1 se si e' verificato un errore nella registrazione del thread (setta \c errno)
+ */
+int epochEnter(void);
+
+/** Fine della sezione di lettura del thread chiamante. */
+void epochExit(void);
+
+/** Ritira un oggetto non piu' raggiungibile dai nuovi lettori: \c fn(p) viene chiamata al termine
+    del periodo di grazia. Se non e' possibile memorizzare l'oggetto, la funzione attende il periodo
+    di grazia e chiama subito \c fn(p).
+
+ \param p oggetto da ritirare
+ \param fn funzione di deallocazione
+ */
+void epochRetire(void* p, void (*fn)(void*));
+
+/** Tenta di far avanzare l'epoca globale e dealloca gli oggetti il cui periodo di grazia e' terminato. */
+void epochReclaim(void);
+
+/** Attende la fine di un periodo di grazia completo (va chiamata fuori da una sezione di lettura):
+    al ritorno nessun lettore puo' vedere oggetti resi irraggiungibili prima della chiamata, e tutti
+    gli oggetti ritirati prima della chiamata sono stati deallocati. */
+void epochBarrier(void);
+
+#endif
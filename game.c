@@ -0,0 +1,94 @@
+/**
+ *  \file game.c
+ *  \author Orlando Leombruni
+ *
+ *  \brief Implementazione dello stato e delle regole di una partita a briscola.
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ */
+
+#include <errno.h>
+#include "game.h"
+#include "newMazzo_r.h"
+
+/** Distribuisce le carte iniziali dal mazzo della partita ed azzera lo stato del gioco */
+static void deal(game_t* g) {
+	int i, p;
+	g->hand[0] = g->hand[1] = SET_EMPTY;
+	g->taken[0] = g->taken[1] = SET_EMPTY;
+	for (i = 0; i < 3; i++) {
+		for (p = 0; p < 2; p++) {
+			g->dealt[p][i] = drawPacked(&(g->deck));
+			SET_ADD(g->hand[p], g->dealt[p][i]);
+		}
+	}
+	g->lead = 0;
+	g->led = NOCARD;
+	g->last.card[0] = g->last.card[1] = NOCARD;
+	g->last.drawn[0] = g->last.drawn[1] = NOCARD;
+	g->last.winner = 0;
+	g->last.points = 0;
+}
+
+void gameInit(game_t* g, uint64_t seed) {
+	shuffleMazzo(&(g->deck), seed);
+	deal(g);
+}
+
+void gameDeal(game_t* g, mazzo_t* m) {
+	g->deck = *m;
+	g->deck.next = 0;
+	deal(g);
+}
+
+int gameTurn(game_t* g) {
+	return (g->led == NOCARD) ? g->lead : 1 - g->lead;
+}
+
+int gamePlay(game_t* g, int player, card_t card) {
+	trick_t* t = &(g->last);
+	int lead = g->lead, p;
+	if (gameIsOver(g) || player != gameTurn(g)) {
+		errno = EPERM;
+		return -1;
+	}
+	if (card >= NCARTE) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!SET_HAS(g->hand[player], card)) {
+		errno = ENOENT;
+		return -1;
+	}
+	SET_DEL(g->hand[player], card);
+	if (player == lead) {
+		g->led = card;
+		return 0;
+	}
+
+	/* Seconda carta del turno: presa e pesca (il vincitore pesca per primo) */
+	t->card[lead] = g->led;
+	t->card[player] = card;
+	t->winner = TRICK_WINS(g->deck.briscola, g->led, card) ? lead : player;
+	t->points = setPoints(CARDBIT(g->led) | CARDBIT(card));
+	g->taken[t->winner] |= CARDBIT(g->led) | CARDBIT(card);
+	t->drawn[t->winner] = drawPacked(&(g->deck));
+	t->drawn[1 - t->winner] = drawPacked(&(g->deck));
+	for (p = 0; p < 2; p++) SET_ADD(g->hand[p], t->drawn[p]);
+	g->lead = t->winner;
+	g->led = NOCARD;
+	return 1;
+}
+
+const trick_t* gameTrickResult(game_t* g) {
+	return &(g->last);
+}
+
+bool_t gameIsOver(game_t* g) {
+	return ((g->hand[0] | g->hand[1]) == SET_EMPTY) ? TRUE : FALSE;
+}
+
+int gameScore(game_t* g, int player) {
+	return setPoints(g->taken[player]);
+}
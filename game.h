@@ -0,0 +1,118 @@
+/**
+ *  \file game.h
+ *  \author Orlando Leombruni
+ *
+ *  \brief Stato e regole di una partita a briscola, indipendenti dal trasporto.
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ */
+
+#ifndef __GAME__H
+#define __GAME__H
+
+#include <stdint.h>
+#include "bris.h"
+
+/** Le funzioni di questo modulo non allocano memoria e non fanno I/O: chi le usa (il server,
+    un simulatore, un giocatore automatico) si occupa della comunicazione con i giocatori e
+    del log. I giocatori sono indicati con 0 (chi ha richiesto la sfida, di mano al primo turno)
+    e 1. */
+
+/** Esito di un turno */
+typedef struct trick {
+  /** Carte giocate nel turno, indicizzate per giocatore */
+  card_t card[2];
+  /** Giocatore che ha vinto il turno (di mano nel turno successivo) */
+  int winner;
+  /** Punti presi dal vincitore */
+  int points;
+  /** Carte pescate a fine turno, indicizzate per giocatore (\c NOCARD se il mazzo e' esaurito);
+      il vincitore pesca per primo */
+  card_t drawn[2];
+} trick_t;
+
+/** Stato di una partita */
+typedef struct game {
+  /** Mazzo */
+  mazzo_t deck;
+  /** Carte distribuite all'inizio della partita, nell'ordine di distribuzione */
+  card_t dealt[2][3];
+  /** Mani dei due giocatori */
+  cardset_t hand[2];
+  /** Carte prese dai due giocatori */
+  cardset_t taken[2];
+  /** Giocatore di mano nel turno in corso */
+  int lead;
+  /** Carta giocata dal giocatore di mano nel turno in corso (\c NOCARD se non ha ancora giocato) */
+  card_t led;
+  /** Esito dell'ultimo turno concluso */
+  trick_t last;
+} game_t;
+
+/** Inizializza una partita: mischia il mazzo a partire dal seme \c seed e distribuisce tre carte
+    a testa, alternativamente a partire dal giocatore 0.
+
+ \param g partita da inizializzare
+ \param seed seme del mazzo (la stessa partita si ottiene sempre dallo stesso seme)
+*/
+void gameInit(game_t* g, uint64_t seed);
+
+/** Inizializza una partita a partire da un mazzo gia' mischiato (copiato nella partita) e
+    distribuisce tre carte a testa, alternativamente a partire dal giocatore 0.
+
+ \param g partita da inizializzare
+ \param m mazzo (ad esempio generato da \c newMazzo_r)
+*/
+void gameDeal(game_t* g, mazzo_t* m);
+
+/** Restituisce il giocatore che deve giocare.
+
+ \param g partita
+
+ \retval p il giocatore di turno (0 o 1)
+*/
+int gameTurn(game_t* g);
+
+/** Gioca una carta: se e' la seconda del turno, decreta il vincitore, gli assegna le carte
+    e fa pescare entrambi i giocatori (a partire dal vincitore).
+
+ \param g partita
+ \param player giocatore che gioca la carta
+ \param card carta giocata
+
+ \retval 0 se la carta e' stata giocata e il turno attende la carta dell'avversario
+ \retval 1 se la carta ha concluso il turno (l'esito e' restituito da \c gameTrickResult)
+ \retval -1 se la carta non e' stata accettata (setta \c errno: \c EINVAL se \c card non e' una carta,
+         \c ENOENT se non e' nella mano del giocatore, \c EPERM se non e' il turno del giocatore o
+         la partita e' finita)
+*/
+int gamePlay(game_t* g, int player, card_t card);
+
+/** Restituisce l'esito dell'ultimo turno concluso.
+
+ \param g partita
+
+ \retval t esito del turno (valido fino alla conclusione del turno successivo)
+*/
+const trick_t* gameTrickResult(game_t* g);
+
+/** Controlla se la partita e' finita.
+
+ \param g partita
+
+ \retval TRUE se entrambi i giocatori hanno giocato tutte le carte
+ \retval FALSE altrimenti
+*/
+bool_t gameIsOver(game_t* g);
+
+/** Restituisce i punti delle carte prese da un giocatore.
+
+ \param g partita
+ \param player giocatore
+
+ \retval np punti del giocatore
+*/
+int gameScore(game_t* g, int player);
+
+#endif
@@ -0,0 +1,248 @@
+/**
+ *  \file journal.c
+ *  \author Orlando Leombruni
+ *
+ *  \brief Implementazione del journal delle registrazioni e cancellazioni di utenti.
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "journal.h"
+
+/** Dimensione iniziale del buffer delle operazioni accodate */
+#define JBUFMIN 4096
+/** Lunghezza massima di una riga del journal (operazione, utente, ':', password, '\\n') */
+#define JLINE (LUSER + LPWD + 3)
+/** Suffisso del file temporaneo usato dalla compattazione */
+#define TMP_SUFFIX ".tmp"
+
+/** Applica all'archivio la riga \c l del journal (senza '\\n'); restituisce 0, 1 se la riga non
+    e' valida (e va trattata come la fine del journal), o -1 se si e' verificato un errore (setta \c errno) */
+static int replayLine(userdb_t* db, char* l) {
+	user_t* u = NULL;
+	int res = 0;
+	if ((l[0] != JOURNAL_ADD && l[0] != JOURNAL_DEL) || (u = stringToUser(l + 1, strlen(l))) == NULL) return 1;
+	/* Le operazioni gia' riflesse nel file degli utenti (compattazione interrotta prima dello
+	   svuotamento del journal) falliscono senza effetti: la riapplicazione e' idempotente */
+	if (l[0] == JOURNAL_ADD) {
+		if ((res = addUserDb(db, u)) != 0) free(u);
+	}
+	else {
+		res = removeUserDb(db, u);
+		free(u);
+	}
+	return (res == -1) ? -1 : 0;
+}
+
+int journalOpen(journal_t* j, char* path, userdb_t* db) {
+	FILE* fin = NULL;
+	char line[JLINE + 2];
+	off_t valid = 0;
+	size_t l = 0;
+	int n = 0, res = 0, err = 0;
+	memset(j, 0, sizeof(journal_t));
+	j->fd = -1;
+	if ((fin = fopen(path, "r")) == NULL && errno != ENOENT) return -1;
+	while (fin != NULL && fgets(line, sizeof(line), fin) != NULL) {
+		/* Una riga senza '\n' e' stata interrotta da un crash (o e' corrotta): il journal finisce qui */
+		if ((l = strlen(line)) == 0 || line[l-1] != '\n') break;
+		line[l-1] = '\0';
+		if ((res = replayLine(db, line)) == -1) {
+			err = errno;
+			fclose(fin);
+			errno = err;
+			return -1;
+		}
+		if (res == 1) break;
+		valid += l;
+		n++;
+	}
+	if (fin != NULL) fclose(fin);
+	if ((j->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) == -1) return -1;
+	if (ftruncate(j->fd, valid) == -1 || (errno = pthread_mutex_init(&(j->mtx), NULL)) != 0) {
+		err = errno;
+		close(j->fd);
+		errno = err;
+		return -1;
+	}
+	if ((errno = pthread_cond_init(&(j->cond), NULL)) != 0) {
+		err = errno;
+		pthread_mutex_destroy(&(j->mtx));
+		close(j->fd);
+		errno = err;
+		return -1;
+	}
+	j->nrec = n;
+	return n;
+}
+
+int journalAppend(journal_t* j, char op, user_t* puser, unsigned long* seq) {
+	char* tmp = NULL;
+	size_t size = 0;
+	pthread_mutex_lock(&(j->mtx));
+	if (j->len + JLINE + 1 > j->size) {
+		size = (j->size == 0) ? JBUFMIN : 2*j->size;
+		if ((tmp = (char*)realloc(j->buf, size)) == NULL) {
+			pthread_mutex_unlock(&(j->mtx));
+			return -1;
+		}
+		j->buf = tmp;
+		j->size = size;
+	}
+	j->len += sprintf(j->buf + j->len, "%c%s:%s\n", op, puser->name, puser->passwd);
+	(*seq) = ++(j->seq);
+	j->nrec++;
+	pthread_mutex_unlock(&(j->mtx));
+	return 0;
+}
+
+/** Scrive \c n byte di \c b nel file (ripetendo le scritture parziali) e li sincronizza su disco;
+    restituisce 0, o -1 se si e' verificato un errore (setta \c errno) */
+static int writeAll(int fd, char* b, size_t n) {
+	ssize_t w = 0;
+	while (n > 0) {
+		if ((w = write(fd, b, n)) == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		b += w;
+		n -= w;
+	}
+	return fdatasync(fd);
+}
+
+int journalSync(journal_t* j, unsigned long seq) {
+	char* b = NULL;
+	size_t n = 0, s = 0;
+	unsigned long upto = 0;
+	int res = 0, err = 0;
+	pthread_mutex_lock(&(j->mtx));
+	while (j->durable < seq && !j->broken) {
+		if (j->flushing) {
+			pthread_cond_wait(&(j->cond), &(j->mtx));
+			continue;
+		}
+		/* Nessuno sta scrivendo: il thread scrive tutte le operazioni accodate finora,
+		   mentre le successive vengono accodate nel buffer di riserva */
+		b = j->buf;
+		n = j->len;
+		s = j->size;
+		upto = j->seq;
+		j->buf = j->spare;
+		j->size = j->ssize;
+		j->len = 0;
+		j->flushing = TRUE;
+		pthread_mutex_unlock(&(j->mtx));
+		res = writeAll(j->fd, b, n);
+		err = errno;
+		pthread_mutex_lock(&(j->mtx));
+		j->spare = b;
+		j->ssize = s;
+		j->flushing = FALSE;
+		if (res == -1) j->broken = TRUE;
+		else j->durable = upto;
+		pthread_cond_broadcast(&(j->cond));
+	}
+	res = (j->durable < seq) ? -1 : 0;
+	pthread_mutex_unlock(&(j->mtx));
+	if (res == -1) errno = (err != 0) ? err : EIO;
+	return res;
+}
+
+bool_t journalFull(journal_t* j, unsigned int nusers) {
+	bool_t full = FALSE;
+	pthread_mutex_lock(&(j->mtx));
+	full = j->broken || (j->nrec >= JOURNAL_MINREC && j->nrec >= nusers);
+	pthread_mutex_unlock(&(j->mtx));
+	return full;
+}
+
+/** Sincronizza su disco la directory che contiene il file \c path (rendendo persistente una
+    \c rename); restituisce 0, o -1 se si e' verificato un errore (setta \c errno) */
+static int syncDir(char* path) {
+	char* dir = NULL;
+	char* slash = NULL;
+	int fd = -1, res = 0, err = 0;
+	if ((slash = strrchr(path, '/')) == NULL) dir = strdup(".");
+	else if ((dir = strdup(path)) != NULL) dir[(slash == path) ? 1 : slash - path] = '\0';
+	if (dir == NULL) return -1;
+	if ((fd = open(dir, O_RDONLY)) == -1) {
+		err = errno;
+		free(dir);
+		errno = err;
+		return -1;
+	}
+	res = fsync(fd);
+	err = errno;
+	close(fd);
+	free(dir);
+	errno = err;
+	return res;
+}
+
+int journalCompact(journal_t* j, userdb_t* db, char* path) {
+	FILE* fout = NULL;
+	char* tmp = NULL;
+	int n = 0, err = 0;
+	if ((tmp = (char*)malloc(strlen(path) + strlen(TMP_SUFFIX) + 1)) == NULL) return -1;
+	sprintf(tmp, "%s%s", path, TMP_SUFFIX);
+	if ((fout = fopen(tmp, "w")) == NULL) {
+		free(tmp);
+		return -1;
+	}
+	if ((n = storeUsers(fout, db->root)) == -1 || fflush(fout) == EOF || fsync(fileno(fout)) == -1) {
+		err = errno;
+		fclose(fout);
+		unlink(tmp);
+		free(tmp);
+		errno = err;
+		return -1;
+	}
+	if (fclose(fout) == EOF || rename(tmp, path) == -1 || syncDir(path) == -1) {
+		err = errno;
+		unlink(tmp);
+		free(tmp);
+		errno = err;
+		return -1;
+	}
+	free(tmp);
+	/* Il file degli utenti contiene ora tutte le operazioni accodate: il journal si svuota
+	   (dopo l'eventuale scrittura in corso, le cui operazioni sono comunque gia' riflesse) */
+	pthread_mutex_lock(&(j->mtx));
+	while (j->flushing) pthread_cond_wait(&(j->cond), &(j->mtx));
+	if (ftruncate(j->fd, 0) == -1) {
+		err = errno;
+		j->broken = TRUE;
+		pthread_mutex_unlock(&(j->mtx));
+		errno = err;
+		return -1;
+	}
+	j->len = 0;
+	j->nrec = 0;
+	j->durable = j->seq;
+	j->broken = FALSE;
+	pthread_cond_broadcast(&(j->cond));
+	pthread_mutex_unlock(&(j->mtx));
+	return n;
+}
+
+void journalClose(journal_t* j) {
+	if (j->fd == -1) return;
+	close(j->fd);
+	j->fd = -1;
+	free(j->buf);
+	free(j->spare);
+	j->buf = NULL;
+	j->spare = NULL;
+	pthread_cond_destroy(&(j->cond));
+	pthread_mutex_destroy(&(j->mtx));
+}
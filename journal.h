@@ -0,0 +1,131 @@
+/**
+ *  \file journal.h
+ *  \author Orlando Leombruni
+ *
+ *  \brief Journal delle registrazioni e cancellazioni di utenti.
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ */
+
+#ifndef __JOURNAL__H
+#define __JOURNAL__H
+
+#include <pthread.h>
+#include "bris.h"
+#include "users.h"
+
+/** Operazione di registrazione */
+#define JOURNAL_ADD '+'
+/** Operazione di cancellazione */
+#define JOURNAL_DEL '-'
+/** Numero minimo di operazioni nel journal prima che ne venga suggerita la compattazione */
+#define JOURNAL_MINREC 4096
+
+/** Journal delle modifiche all'archivio degli utenti: file in sola aggiunta, affiancato al file
+    degli utenti, con una riga \c +nome_user:password per ogni registrazione ed una riga
+    \c -nome_user:password per ogni cancellazione, nell'ordine in cui sono state applicate.
+    All'avvio il file degli utenti, seguito dal journal, ricostruisce l'archivio; la compattazione
+    riscrive il file degli utenti a partire dall'archivio e svuota il journal.
+
+    Le operazioni vengono accodate in memoria (\c journalAppend) e rese persistenti da
+    \c journalSync con scritture di gruppo: un solo thread alla volta scrive e sincronizza
+    su disco tutte le operazioni accodate fino a quel momento, mentre gli altri ne attendono
+    l'esito, per cui piu' operazioni concorrenti condividono la stessa \c fdatasync. */
+typedef struct journal {
+  /** Descrittore del file (aperto in aggiunta) */
+  int fd;
+  /** Mutex sui campi del journal */
+  pthread_mutex_t mtx;
+  /** Condizione di fine scrittura */
+  pthread_cond_t cond;
+  /** Operazioni accodate e non ancora scritte */
+  char* buf;
+  /** Lunghezza delle operazioni accodate */
+  size_t len;
+  /** Dimensione di \c buf */
+  size_t size;
+  /** Buffer di riserva, scambiato con \c buf durante una scrittura */
+  char* spare;
+  /** Dimensione di \c spare */
+  size_t ssize;
+  /** Numero di sequenza dell'ultima operazione accodata */
+  unsigned long seq;
+  /** Numero di sequenza dell'ultima operazione resa persistente */
+  unsigned long durable;
+  /** Numero di operazioni nel journal (dall'ultima compattazione) */
+  unsigned long nrec;
+  /** TRUE se un thread sta scrivendo su disco */
+  bool_t flushing;
+  /** TRUE se una scrittura e' fallita (il journal e' inutilizzabile fino alla prossima compattazione) */
+  bool_t broken;
+} journal_t;
+
+/** Riapplica all'archivio le operazioni contenute nel journal \c path (se esiste), scarta
+    l'eventuale ultima riga incompleta (scrittura interrotta da un crash) ed apre il journal
+    per le nuove operazioni.
+
+ \param j journal da inizializzare
+ \param path nome del file del journal
+ \param db archivio degli utenti, gia' caricato dal file degli utenti
+
+ \retval n il numero di operazioni riapplicate
+ \retval -1 se si e' verificato un errore (setta \c errno)
+*/
+int journalOpen(journal_t* j, char* path, userdb_t* db);
+
+/** Accoda un'operazione, gia' applicata all'archivio, al journal (va chiamata nello stesso
+    ordine in cui le operazioni sono applicate all'archivio).
+
+ \param j journal
+ \param op operazione (\c JOURNAL_ADD o \c JOURNAL_DEL)
+ \param puser utente registrato o cancellato
+ \param seq puntatore in cui viene memorizzato il numero di sequenza dell'operazione
+
+ \retval 0 se tutto ok
+ \retval -1 se si e' verificato un errore (setta \c errno)
+*/
+int journalAppend(journal_t* j, char op, user_t* puser, unsigned long* seq);
+
+/** Attende che le operazioni accodate fino al numero di sequenza \c seq siano su disco,
+    scrivendole (insieme a tutte quelle accodate nel frattempo) se nessun altro thread lo sta facendo.
+
+ \param j journal
+ \param seq numero di sequenza restituito da \c journalAppend
+
+ \retval 0 se tutto ok
+ \retval -1 se si e' verificato un errore (setta \c errno); in tal caso il journal va compattato
+*/
+int journalSync(journal_t* j, unsigned long seq);
+
+/** Indica se il journal contiene abbastanza operazioni da rendere conveniente una compattazione
+    (almeno \c JOURNAL_MINREC e almeno quanti sono gli utenti), o se e' inutilizzabile.
+
+ \param j journal
+ \param nusers numero di utenti dell'archivio
+
+ \retval TRUE se il journal va compattato
+ \retval FALSE altrimenti
+*/
+bool_t journalFull(journal_t* j, unsigned int nusers);
+
+/** Compatta il journal: scrive l'archivio in un file temporaneo, lo sincronizza su disco, lo
+    sostituisce atomicamente al file degli utenti e svuota il journal. L'archivio non deve essere
+    modificato durante la chiamata.
+
+ \param j journal
+ \param db archivio degli utenti
+ \param path nome del file degli utenti
+
+ \retval n il numero di utenti scritti
+ \retval -1 se si e' verificato un errore (setta \c errno); il file degli utenti e il journal restano validi
+*/
+int journalCompact(journal_t* j, userdb_t* db, char* path);
+
+/** Chiude il journal e ne dealloca le risorse.
+
+ \param j journal
+*/
+void journalClose(journal_t* j);
+
+#endif
@@ -0,0 +1,97 @@
+/**
+ *  \file newMazzo_r.c
+ *  \author Orlando Leombruni
+ *
+ *  \brief Implementazione della generazione thread-safe dei mazzi di carte mischiati.
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ */
+
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "newMazzo_r.h"
+
+/** Rotazione a sinistra di \c k bit */
+#define ROTL(x, k) (((x) << (k)) | ((x) >> (64 - (k))))
+
+/** Passo del generatore splitmix64, usato per espandere il seme nello stato di xoshiro256** */
+static uint64_t splitmix64(uint64_t* x) {
+	uint64_t z = ((*x) += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+/** Passo del generatore xoshiro256** */
+static uint64_t xoshiro(uint64_t s[4]) {
+	uint64_t r = ROTL(s[1] * 5, 7) * 9, t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = ROTL(s[3], 45);
+	return r;
+}
+
+/** Restituisce un numero uniforme in [0, n) (moltiplicazione a 64 bit con scarto dei
+    valori che introdurrebbero una distorsione) */
+static unsigned int bounded(uint64_t s[4], uint32_t n) {
+	uint64_t m = (xoshiro(s) >> 32) * n;
+	uint32_t low = (uint32_t)m, threshold;
+	if (low < n) {
+		threshold = -n % n;
+		while (low < threshold) {
+			m = (xoshiro(s) >> 32) * n;
+			low = (uint32_t)m;
+		}
+	}
+	return (unsigned int)(m >> 32);
+}
+
+void shuffleMazzo(mazzo_t* m, uint64_t seed) {
+	uint64_t s[4];
+	carta_t tmp;
+	int i, j;
+	for (i = 0; i < 4; i++) s[i] = splitmix64(&seed);
+	for (i = 0; i < NCARTE; i++) {
+		m->carte[i].val = i % 10;
+		m->carte[i].seme = i / 10;
+	}
+	for (i = NCARTE - 1; i > 0; i--) {
+		j = bounded(s, i + 1);
+		tmp = m->carte[i];
+		m->carte[i] = m->carte[j];
+		m->carte[j] = tmp;
+	}
+	m->next = 0;
+	m->briscola = m->carte[NCARTE - 1].seme;
+}
+
+uint64_t baseSeed(bool_t test) {
+	if (test) return TEST_SEED;
+	return ((uint64_t)time(NULL) << 32) ^ (uint64_t)getpid();
+}
+
+/* Se si usano i moduli oggetto newMazzo*.o forniti dai docenti (che generano i mazzi di riferimento
+   dei test) le due funzioni seguenti sono definite da quelli */
+#ifndef NEWMAZZO_OBJ
+/** Numero di mazzi generati da \c newMazzo_r */
+static uint64_t nmazzi = 0;
+
+mazzo_t* newMazzo(void) {
+	mazzo_t* m = NULL;
+	if ((m = (mazzo_t*)malloc(sizeof(mazzo_t))) == NULL) return NULL;
+	shuffleMazzo(m, ((uint64_t)rand() << 32) ^ (uint64_t)rand());
+	return m;
+}
+
+mazzo_t* newMazzo_r(bool_t test) {
+	mazzo_t* m = NULL;
+	if ((m = (mazzo_t*)malloc(sizeof(mazzo_t))) == NULL) return NULL;
+	shuffleMazzo(m, baseSeed(test) + __atomic_add_fetch(&nmazzi, 1, __ATOMIC_RELAXED));
+	return m;
+}
+#endif
@@ -0,0 +1,56 @@
+/**
+ *  \file newMazzo_r.h
+ *  \author Orlando Leombruni
+ *
+ *  \brief Generazione thread-safe e riproducibile dei mazzi di carte mischiati.
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ */
+
+#ifndef __NEWMAZZO_R__H
+#define __NEWMAZZO_R__H
+
+#include <stdint.h>
+#include "bris.h"
+
+/** Ogni mazzo viene mischiato con l'algoritmo di Fisher-Yates usando un generatore pseudocasuale
+    (xoshiro256**) il cui stato e' locale alla chiamata ed e' inizializzato da un seme a 64 bit:
+    partite concorrenti non condividono alcuno stato, e lo stesso seme produce sempre lo stesso
+    mazzo, per cui ogni partita e' riproducibile a partire dal proprio seme. */
+
+/** Seme di base della modalita' test */
+#define TEST_SEED ((uint64_t)2013)
+
+/** Riempie un mazzo con le \c NCARTE carte mischiate a partire dal seme \c seed (la briscola
+    e' il seme dell'ultima carta del mazzo), senza allocare memoria.
+
+ \param m mazzo da riempire (fornito dal chiamante)
+ \param seed seme del generatore pseudocasuale
+*/
+void shuffleMazzo(mazzo_t* m, uint64_t seed);
+
+/** Restituisce un seme da cui derivare i semi delle partite (aggiungendo il numero della partita).
+
+ \param test TRUE se il server e' in modalita' test
+
+ \retval TEST_SEED se \c test e' TRUE
+ \retval s un seme ricavato dall'ora corrente e dal pid del processo altrimenti
+*/
+uint64_t baseSeed(bool_t test);
+
+/** Genera un mazzo di carte mischiato; versione thread-safe di \c newMazzo, che non richiede la
+    srand() (in modalita' test la sequenza dei mazzi generati e' sempre la stessa: l'i-esimo mazzo
+    e' quello di seme <tt>TEST_SEED + i</tt>).
+
+    \note Se la libreria e' compilata con i moduli oggetto forniti dai docenti (\c NEWMAZZO_OBJ),
+    la funzione e' quella del modulo oggetto fornito, che genera i mazzi di riferimento dei test.
+
+ \param test TRUE se il server e' in modalita' test
+
+ \retval p puntatore al nuovo mazzo (da deallocare con \c freeMazzo)
+ \retval NULL se si e' verificato un errore (setta \c errno)
+*/
+mazzo_t* newMazzo_r(bool_t test);
+
+#endif
@@ -0,0 +1,172 @@
+/**
+ *  \file stressusers.c
+ *  \author Orlando Leombruni
+ *
+ *  \brief Stress test delle visite dell'albero degli utenti su un thread con stack ridotto.
+ *
+ *  Uso: <tt>stressusers [-n utenti] [-k KiB di stack]</tt>
+ *
+ *  In un thread con uno stack di 64 KiB (come quello del thread che gestisce il checkpoint
+ *  su SIGUSR1) carica \c n utenti (5 milioni per default) con \c loadUsers, li cerca tutti,
+ *  ne rimuove uno su due con \c removeUser, ne reinserisce in ordine decrescente un quarto
+ *  con \c addUser, costruisce la lista con \c getUserList, salva l'albero con \c storeUsers
+ *  e lo dealloca con \c freeTree. Il file salvato deve coincidere con quello atteso e
+ *  l'albero deve restare bilanciato: in caso contrario il programma termina con errore.
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "users.h"
+
+/** Numero di utenti */
+static unsigned int nusers = 5000000;
+
+/** Stampa un messaggio di errore e termina il processo */
+static void fail(char* msg) {
+	perror(msg);
+	exit(EXIT_FAILURE);
+}
+
+/** Dati dell'i-esimo utente */
+static void fillUser(user_t* pu, unsigned int i) {
+	sprintf(pu->name, "u%08u", i);
+	sprintf(pu->passwd, "p%07u", i % 10000000);
+}
+
+/** Controlla che l'i-esimo utente sia presente se e solo se \c present */
+static void check(nodo_t* r, unsigned int i, bool_t present) {
+	user_t u;
+	fillUser(&u, i);
+	if ((findUser(r, u.name) != NULL) != (present == TRUE)) {
+		fprintf(stderr, "utente %s: atteso %s\n", u.name, present ? "presente" : "assente");
+		exit(EXIT_FAILURE);
+	}
+}
+
+/** Controlla se l'i-esimo utente e' nell'albero dopo il reinserimento (indice pari o 4k+1) */
+static bool_t kept(unsigned int i) {
+	return (i % 2 == 0 || i % 4 == 1) ? TRUE : FALSE;
+}
+
+/** Corpo del test, eseguito sullo stack ridotto */
+static void* stress(void* arg) {
+	nodo_t* r = NULL;
+	user_t u, *pu = NULL;
+	FILE *fin = NULL, *fout = NULL;
+	char *list = NULL, line[LUSER + LPWD + 3], expect[LUSER + LPWD + 3];
+	unsigned int i, count = 0, height = 0;
+	size_t len = 0;
+
+	/* File ordinato degli utenti e caricamento */
+	if ((fin = tmpfile()) == NULL) fail("tmpfile");
+	for (i = 0; i < nusers; i++) {
+		fillUser(&u, i);
+		fprintf(fin, "%s:%s\n", u.name, u.passwd);
+	}
+	rewind(fin);
+	if (loadUsers(fin, &r) != nusers) fail("loadUsers");
+	fclose(fin);
+	printf("caricati %u utenti, altezza %u\n", nusers, r->height);
+
+	/* Ricerche e rimozione degli utenti dispari */
+	for (i = 0; i < nusers; i++) check(r, i, TRUE);
+	for (i = 1; i < nusers; i += 2) {
+		fillUser(&u, i);
+		if (removeUser(&r, &u) != 0) fail("removeUser");
+	}
+	for (i = 0; i < nusers; i++) check(r, i, (i % 2 == 0) ? TRUE : FALSE);
+	printf("rimossi %u utenti, altezza %u\n", nusers / 2, r->height);
+
+	/* Reinserimento in ordine decrescente degli utenti di indice 4k+1 */
+	for (i = nusers; i-- > 0; ) {
+		if (i % 4 != 1) continue;
+		if ((pu = (user_t*)malloc(sizeof(user_t))) == NULL) fail("malloc");
+		fillUser(pu, i);
+		if (addUser(&r, pu) != 0) fail("addUser");
+	}
+	for (i = 0; i < nusers; i++) {
+		check(r, i, kept(i));
+		if (kept(i)) {
+			fillUser(&u, i);
+			len += strlen(u.name) + 1;
+			count++;
+		}
+	}
+	printf("reinseriti, %u utenti, altezza %u\n", count, r->height);
+	for (height = 0; (1u << height) <= count; height++) ;
+	if (r->height > 1.45 * height) {
+		fprintf(stderr, "albero sbilanciato: altezza %u con %u utenti\n", r->height, count);
+		exit(EXIT_FAILURE);
+	}
+
+	/* Lista degli utenti */
+	if ((list = getUserList(r, DISCONNECTED)) == NULL) fail("getUserList");
+	if (strlen(list) != len - 1) {
+		fprintf(stderr, "lista di lunghezza errata: %lu\n", (unsigned long)strlen(list));
+		exit(EXIT_FAILURE);
+	}
+	free(list);
+
+	/* Salvataggio e confronto con gli utenti attesi */
+	if ((fout = tmpfile()) == NULL) fail("tmpfile");
+	if (storeUsers(fout, r) != count) fail("storeUsers");
+	rewind(fout);
+	for (i = 0; i < nusers; i++) {
+		if (!kept(i)) continue;
+		fillUser(&u, i);
+		sprintf(expect, "%s:%s\n", u.name, u.passwd);
+		if (fgets(line, sizeof(line), fout) == NULL || strcmp(line, expect) != 0) {
+			fprintf(stderr, "file salvato diverso dall'atteso: utente %s\n", u.name);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (fgets(line, sizeof(line), fout) != NULL) {
+		fprintf(stderr, "file salvato diverso dall'atteso: righe in eccesso\n");
+		exit(EXIT_FAILURE);
+	}
+	fclose(fout);
+	printf("salvati %u utenti\n", count);
+
+	freeTree(r);
+	return NULL;
+}
+
+int main(int argc, char* argv[]) {
+	pthread_t tid;
+	pthread_attr_t attr;
+	size_t stack = 64;
+	int opt, err;
+
+	while ((opt = getopt(argc, argv, "n:k:")) != -1) {
+		switch (opt) {
+			case 'n': nusers = atoi(optarg); break;
+			case 'k': stack = atoi(optarg); break;
+			default:
+				fprintf(stderr, "uso: %s [-n utenti] [-k KiB di stack]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (nusers < 2) {
+		fprintf(stderr, "parametri non validi\n");
+		return EXIT_FAILURE;
+	}
+	pthread_attr_init(&attr);
+	if ((err = pthread_attr_setstacksize(&attr, stack * 1024)) != 0) {
+		fprintf(stderr, "stack di %lu KiB non valido\n", (unsigned long)stack);
+		return EXIT_FAILURE;
+	}
+	if ((err = pthread_create(&tid, &attr, stress, NULL)) != 0) {
+		fprintf(stderr, "pthread_create: %s\n", strerror(err));
+		return EXIT_FAILURE;
+	}
+	pthread_join(tid, NULL);
+	pthread_attr_destroy(&attr);
+	printf("OK (stack di %lu KiB)\n", (unsigned long)stack);
+	return 0;
+}
@@ -0,0 +1,161 @@
+/**
+ *  \file testtrick.c
+ *  \author Orlando Leombruni
+ *
+ *  \brief Verifica esaustiva della tabella delle prese e confronto delle prestazioni con \c compareCard.
+ *
+ *  Uso: <tt>testtrick [-n confronti]</tt>
+ *
+ *  Per ogni briscola e ogni coppia di carte diverse controlla che \c comparePacked e \c TRICK_WINS
+ *  diano lo stesso esito di \c compareCard (e che \c packCard e \c unpackCard siano una l'inversa
+ *  dell'altra), e che \c setPoints dia gli stessi punti di \c computePoints su ogni carta singola e
+ *  su \c NSETS insiemi di carte pseudocasuali: in caso contrario stampa le differenze e termina con
+ *  errore. Poi misura il tempo medio di un confronto con le tre funzioni su una sequenza
+ *  pseudocasuale di coppie di carte diverse (i tre conteggi delle prese stampati devono coincidere).
+ *
+ * Si dichiara che il contenuto di questo file è in ogni sua parte opera originale dell'autore.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "bris.h"
+#include "bench.h"
+
+/** Lunghezza della sequenza di confronti usata nel benchmark */
+#define NSEQ 4096
+/** Numero di insiemi di carte pseudocasuali su cui verificare \c setPoints */
+#define NSETS 100000
+
+/** Confronta le tre funzioni su tutti i 4x40x39 casi; restituisce il numero di differenze */
+static int check(void) {
+	carta_t ca, cb, cu;
+	card_t ka, kb;
+	int b, a, c, bad = 0;
+	bool_t ref;
+	for (a = 0; a < NCARTE; a++) {
+		ca.seme = a / 10;
+		ca.val = a % 10;
+		unpackCard(packCard(&ca), &cu);
+		if (cu.seme != ca.seme || cu.val != ca.val) {
+			fprintf(stderr, "packCard/unpackCard: carta %d\n", a);
+			bad++;
+		}
+	}
+	for (b = 0; b < 4; b++)
+		for (a = 0; a < NCARTE; a++)
+			for (c = 0; c < NCARTE; c++) {
+				if (a == c) continue;
+				ca.seme = a / 10;
+				ca.val = a % 10;
+				cb.seme = c / 10;
+				cb.val = c % 10;
+				ka = packCard(&ca);
+				kb = packCard(&cb);
+				ref = compareCard(b, &ca, &cb);
+				if (comparePacked(b, ka, kb) != ref || TRICK_WINS(b, ka, kb) != ref) {
+					fprintf(stderr, "briscola %d, carte %d e %d: compareCard %d, comparePacked %d, TRICK_WINS %d\n",
+						b, a, c, ref, comparePacked(b, ka, kb), TRICK_WINS(b, ka, kb));
+					bad++;
+				}
+			}
+	return bad;
+}
+
+/** Confronta \c setPoints con \c computePoints su ogni carta singola e su \c NSETS insiemi
+    pseudocasuali (compresi quello vuoto e quello completo); restituisce il numero di differenze */
+static int checkPoints(void) {
+	carta_t cards[NCARTE], *pc[NCARTE];
+	cardset_t s;
+	unsigned long seed = 2013;
+	int i, k, n, ref, bad = 0;
+	for (i = 0; i < NCARTE; i++) {
+		cards[i].seme = i / 10;
+		cards[i].val = i % 10;
+	}
+	for (i = 0; i < NCARTE + NSETS; i++) {
+		if (i < NCARTE) s = CARDBIT(i);
+		else if (i == NCARTE) s = SET_EMPTY;
+		else if (i == NCARTE + 1) s = SET_ALL;
+		else {
+			seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+			s = (seed >> 24) & SET_ALL;
+		}
+		for (k = 0, n = 0; k < NCARTE; k++)
+			if (s & CARDBIT(k)) pc[n++] = &cards[k];
+		if ((ref = computePoints(pc, n)) != setPoints(s)) {
+			fprintf(stderr, "insieme %#llx: computePoints %d, setPoints %d\n",
+				(unsigned long long)s, ref, setPoints(s));
+			bad++;
+		}
+	}
+	return bad;
+}
+
+int main(int argc, char* argv[]) {
+	static carta_t cards[NCARTE];
+	static card_t a[NSEQ], c[NSEQ];
+	static semi_t b[NSEQ];
+	struct timespec t0;
+	unsigned long n = 50000000, i, k, seed = 2013;
+	long wins = 0;
+	int opt, bad;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+			case 'n': n = atol(optarg); break;
+			default:
+				fprintf(stderr, "uso: %s [-n confronti]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if ((bad = check()) != 0) {
+		fprintf(stderr, "%d differenze\n", bad);
+		return EXIT_FAILURE;
+	}
+	printf("tabella delle prese: 4x%dx%d casi corretti\n", NCARTE, NCARTE - 1);
+	if ((bad = checkPoints()) != 0) {
+		fprintf(stderr, "%d differenze nei punti\n", bad);
+		return EXIT_FAILURE;
+	}
+	printf("setPoints: %d carte singole e %d insiemi corretti\n", NCARTE, NSETS);
+	if (n == 0) return 0;
+
+	for (i = 0; i < NCARTE; i++) {
+		cards[i].seme = i / 10;
+		cards[i].val = i % 10;
+	}
+	for (i = 0; i < NSEQ; i++) {
+		seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+		a[i] = (seed >> 33) % NCARTE;
+		c[i] = (seed >> 45) % NCARTE;
+		if (c[i] == a[i]) c[i] = (c[i] + 1) % NCARTE;
+		b[i] = (seed >> 58) % 4;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++) {
+		k = i & (NSEQ - 1);
+		wins += compareCard(b[k], &cards[a[k]], &cards[c[k]]);
+	}
+	printf("compareCard:   %6.2f ns/confronto (%ld)\n", elapsed(&t0) * 1e9 / n, wins);
+
+	wins = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++) {
+		k = i & (NSEQ - 1);
+		wins += comparePacked(b[k], a[k], c[k]);
+	}
+	printf("comparePacked: %6.2f ns/confronto (%ld)\n", elapsed(&t0) * 1e9 / n, wins);
+
+	wins = 0;
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < n; i++) {
+		k = i & (NSEQ - 1);
+		wins += TRICK_WINS(b[k], a[k], c[k]);
+	}
+	printf("TRICK_WINS:    %6.2f ns/confronto (%ld)\n", elapsed(&t0) * 1e9 / n, wins);
+	return 0;
+}
@@ -14,32 +14,41 @@
 #include <errno.h>
 #include "bris.h"
 #include "users.h"
+#include "epoch.h"
 
-user_t* stringToUser(char* r, unsigned int l){
-	user_t* p = NULL;
+/** Converte una stringa \c nome_user:password (lunga al piu' \c l caratteri) nella struttura \c p;
+    restituisce 0, o -1 se la stringa non e' nel formato corretto (setta \c errno) */
+static int parseUser(char* r, unsigned int l, user_t* p) {
 	char* pointer = NULL;
 	int i = 0, j = 0;
-	p = (user_t*)malloc(sizeof(user_t));
-	if (p == NULL) return NULL;
 	pointer = r;
 	while (pointer[i] != ':' && i < l) {
 		i++;
 	}
 	if (i == 0 || i > LUSER || i == l) {
-		free(p);
 		errno = EINVAL;
-		return NULL;
+		return -1;
 	}
 	strncpy(p->name, r, i);
 	p->name[i] = '\0';
 	i++;
 	while (pointer[i+j] != '\0' && i+j < l) j++;
 	if (j == 0 || j > LPWD || i+j == l) {
-		free(p);
 		errno = EINVAL;
-		return NULL;
+		return -1;
 	}
 	strcpy(p->passwd, pointer+i);
+	return 0;
+}
+
+user_t* stringToUser(char* r, unsigned int l){
+	user_t* p = NULL;
+	p = (user_t*)malloc(sizeof(user_t));
+	if (p == NULL) return NULL;
+	if (parseUser(r, l, p) == -1) {
+		free(p);
+		return NULL;
+	}
 	return p;
 }
 
@@ -60,11 +69,133 @@ char* userToString(user_t* puser) {
 	return p;
 }
 
+/** Logaritmo del numero di nodi di un blocco dell'arena */
+#define SLABSHIFT 16
+/** Numero di nodi di un blocco dell'arena */
+#define SLABSIZE (1U << SLABSHIFT)
+/** Numero massimo di blocchi (gli indici dei nodi sono a 32 bit) */
+#define NSLABS (1U << (32 - SLABSHIFT))
+
+/** Arena dei nodi: blocchi di \c SLABSIZE nodi, allocati quando servono e mai spostati
+    (la tabella dei blocchi ha dimensione fissa, per cui la traduzione da indice a nodo
+    non richiede sincronizzazione con le allocazioni) */
+static nodo_t* slab[NSLABS];
+/** Primo indice mai assegnato (l'indice 0 e' riservato a \c NONODE) */
+static nodeid_t slab_top = 1;
+/** Testa della lista dei nodi liberi, concatenati tramite il campo \c right */
+static nodeid_t slab_free = NONODE;
+/** Numero di nodi in uso */
+static unsigned int slab_live = 0;
+
+/** Restituisce il nodo di indice \c i (\c NULL se \c i == \c NONODE) */
+static nodo_t* nodeAt(nodeid_t i) {
+	return (i == NONODE) ? NULL : &(slab[i >> SLABSHIFT][i & (SLABSIZE - 1)]);
+}
+
+/** Alloca un nodo dall'arena (riusando per primi quelli liberati) e lo inizializza
+    come foglia disconnessa; restituisce \c NULL se si e' verificato un errore (setta \c errno) */
+static nodo_t* allocNode(void) {
+	nodo_t* new = NULL;
+	nodeid_t i;
+	if (slab_free != NONODE) {
+		i = slab_free;
+		new = nodeAt(i);
+		slab_free = new->right;
+	}
+	else {
+		if (slab_top == NONODE) {	/* Indici esauriti */
+			errno = ENOMEM;
+			return NULL;
+		}
+		if (slab[slab_top >> SLABSHIFT] == NULL &&
+		   (slab[slab_top >> SLABSHIFT] = (nodo_t*)malloc(SLABSIZE*sizeof(nodo_t))) == NULL) return NULL;
+		i = slab_top++;
+		new = nodeAt(i);
+	}
+	new->id = i;
+	new->height = 1;
+	new->status = DISCONNECTED;
+	new->channel = -1;
+	new->left = NONODE;
+	new->right = NONODE;
+	new->wheight = 1;
+	new->wcount = 1;
+	new->wleft = NONODE;
+	new->wright = NONODE;
+	new->hnext[0] = NONODE;
+	new->hnext[1] = NONODE;
+	new->hash = 0;
+	slab_live++;
+	return new;
+}
+
+/** Restituisce un nodo all'arena; quando non restano nodi in uso i blocchi vengono deallocati */
+static void freeNode(nodo_t* n) {
+	unsigned int i;
+	n->right = slab_free;
+	slab_free = n->id;
+	if (--slab_live == 0) {
+		for (i = 0; i < NSLABS && slab[i] != NULL; i++) {
+			free(slab[i]);
+			slab[i] = NULL;
+		}
+		slab_top = 1;
+		slab_free = NONODE;
+	}
+}
+
+/** Altezza massima di un albero: un albero AVL con al piu' 2^32 nodi ha altezza minore di 48,
+    per cui le pile esplicite delle visite hanno dimensione fissa */
+#define MAXHEIGHT 64
+
+/* Ogni nodo appartiene a due alberi AVL: l'albero di tutti gli utenti (campi left, right, height)
+   e, se in attesa, l'albero della lobby (campi wleft, wright, wheight, wcount). Le funzioni seguenti
+   operano sull'uno o sull'altro a seconda del parametro w (TRUE per la lobby). */
+
+/** Figlio sinistro di \c n nell'albero selezionato da \c w (utilizzabile come lvalue) */
+#define LEFT(n, w) (*((w) ? &((n)->wleft) : &((n)->left)))
+/** Figlio destro di \c n nell'albero selezionato da \c w (utilizzabile come lvalue) */
+#define RIGHT(n, w) (*((w) ? &((n)->wright) : &((n)->right)))
+/** Altezza di \c n nell'albero selezionato da \c w (utilizzabile come lvalue) */
+#define HEIGHT(n, w) (*((w) ? &((n)->wheight) : &((n)->height)))
+
+/** Stato di una visita simmetrica iterativa: pila dei nodi di cui resta da visitare
+    il nodo stesso e il sottoalbero destro */
+typedef struct visit {
+	nodo_t* stack[MAXHEIGHT];
+	int top;
+	/** Albero visitato (\c TRUE per la lobby) */
+	bool_t w;
+} visit_t;
+
+/** Impila il cammino dal nodo \c n al minimo del suo sottoalbero */
+static void pushLeft(visit_t* v, nodo_t* n) {
+	for (; n != NULL; n = nodeAt(LEFT(n, v->w))) v->stack[v->top++] = n;
+}
+
+/** Inizia la visita simmetrica dell'albero radicato in \c r */
+static void visitBegin(visit_t* v, nodo_t* r, bool_t w) {
+	v->top = 0;
+	v->w = w;
+	pushLeft(v, r);
+}
+
+/** Restituisce il prossimo nodo in ordine lessicografico (\c NULL a visita terminata);
+    il figlio destro del nodo restituito e' gia' stato letto, per cui il nodo puo' essere liberato */
+static nodo_t* visitNext(visit_t* v) {
+	nodo_t* n = NULL;
+	if (v->top == 0) return NULL;
+	n = v->stack[--v->top];
+	pushLeft(v, nodeAt(RIGHT(n, v->w)));
+	return n;
+}
+
 void printTree(nodo_t* r) {
-	if (r != NULL) {
-		char* user_val;
-		printTree(r->left);
-		user_val = userToString(r->user);
+	visit_t v;
+	char* user_val;
+	visitBegin(&v, r, FALSE);
+	while ((r = visitNext(&v)) != NULL) {
+		user_val = userToString(&(r->user));
 		if (user_val != NULL) {
 			fprintf(stdout, "Utente: %s,", user_val);
 			free(user_val);
@@ -74,167 +205,315 @@ void printTree(nodo_t* r) {
 			if (r->status == PLAYING) fprintf(stdout, "sta giocando,");
 			fprintf(stdout, " canale: %d\n", r->channel);
 		}
-		printTree(r->right);
 	}
 }
 
-int addUser(nodo_t** r, user_t* puser) {
-	if (r != NULL) {
-		if ((*r) == NULL) {
-			nodo_t* new = NULL;
-			new = (nodo_t*)malloc(sizeof(nodo_t));
-			if (new == NULL) return -1;
-			new->user = puser;
-			new->status = DISCONNECTED;
-			new->channel = -1;
-			new->left = NULL;
-			new->right = NULL;
-			(*r) = new;
-			return 0;
-		}
-		else {
-			if (strcmp((*r)->user->name, puser->name) > 0) return addUser(&((*r)->left), puser);
-			else if (strcmp((*r)->user->name, puser->name) < 0) return addUser(&((*r)->right), puser);
-			else return 1;
-		}
+/** Altezza di un sottoalbero (0 se vuoto) */
+static int height(nodeid_t i, bool_t w) {
+	return (i == NONODE) ? 0 : HEIGHT(nodeAt(i), w);
+}
+
+/** Numero di nodi di un sottoalbero della lobby (0 se vuoto) */
+static unsigned int wcount(nodeid_t i) {
+	return (i == NONODE) ? 0 : nodeAt(i)->wcount;
+}
+
+/** Ricalcola l'altezza di un nodo (e, nella lobby, la dimensione del sottoalbero) a partire dai figli */
+static void fixHeight(nodo_t* n, bool_t w) {
+	int hl = height(LEFT(n, w), w), hr = height(RIGHT(n, w), w);
+	HEIGHT(n, w) = 1 + ((hl > hr) ? hl : hr);
+	if (w) n->wcount = 1 + wcount(n->wleft) + wcount(n->wright);
+}
+
+/** Rotazione a destra del sottoalbero radicato in \c n; restituisce la nuova radice */
+static nodo_t* rotateRight(nodo_t* n, bool_t w) {
+	nodo_t* l = nodeAt(LEFT(n, w));
+	LEFT(n, w) = RIGHT(l, w);
+	RIGHT(l, w) = n->id;
+	fixHeight(n, w);
+	fixHeight(l, w);
+	return l;
+}
+
+/** Rotazione a sinistra del sottoalbero radicato in \c n; restituisce la nuova radice */
+static nodo_t* rotateLeft(nodo_t* n, bool_t w) {
+	nodo_t* r = nodeAt(RIGHT(n, w));
+	RIGHT(n, w) = LEFT(r, w);
+	LEFT(r, w) = n->id;
+	fixHeight(n, w);
+	fixHeight(r, w);
+	return r;
+}
+
+/** Ribilancia il sottoalbero radicato in \c n (i cui figli sono bilanciati); restituisce la nuova radice */
+static nodo_t* rebalance(nodo_t* n, bool_t w) {
+	nodo_t* c = NULL;
+	fixHeight(n, w);
+	if (height(LEFT(n, w), w) - height(RIGHT(n, w), w) > 1) {
+		c = nodeAt(LEFT(n, w));
+		if (height(LEFT(c, w), w) < height(RIGHT(c, w), w)) LEFT(n, w) = rotateLeft(c, w)->id;
+		return rotateRight(n, w);
 	}
+	if (height(RIGHT(n, w), w) - height(LEFT(n, w), w) > 1) {
+		c = nodeAt(RIGHT(n, w));
+		if (height(RIGHT(c, w), w) < height(LEFT(c, w), w)) RIGHT(n, w) = rotateRight(c, w)->id;
+		return rotateLeft(n, w);
+	}
+	return n;
 }
 
-bool_t checkPwd(nodo_t* r, user_t* user) {
-	if (r != NULL) {
-		if (strcmp(r->user->name, user->name) == 0) {
-			if (strcmp(r->user->passwd, user->passwd) == 0) return TRUE;
-			else return FALSE;
-		}
-		else {
-			if (strcmp(r->user->name, user->name) > 0) return checkPwd(r->left, user);
-			else return checkPwd(r->right, user);
+/** Sostituisce il figlio \c old di \c p con \c new (eventualmente \c NULL) */
+static void setChild(nodo_t* p, nodo_t* old, nodo_t* new, bool_t w) {
+	nodeid_t i = (new == NULL) ? NONODE : new->id;
+	if (LEFT(p, w) == old->id) LEFT(p, w) = i;
+	else RIGHT(p, w) = i;
+}
+
+/** Ribilancia, risalendo, i nodi del cammino \c path[0..d-1] dalla radice \c r (in cui
+    \c path[i+1] e' figlio di \c path[i]); restituisce la nuova radice */
+static nodo_t* rebalancePath(nodo_t** path, int d, nodo_t* r, bool_t w) {
+	nodo_t* n = NULL;
+	int i;
+	for (i = d-1; i >= 0; i--) {
+		n = rebalance(path[i], w);
+		if (i > 0) setChild(path[i-1], path[i], n, w);
+		else r = n;
+	}
+	return r;
+}
+
+/** Inserisce il nodo \c new (foglia) nell'albero radicato in \c r, ribilanciandolo; restituisce la
+    nuova radice e setta \c *res a 1 se un utente con lo stesso nome e' gia' presente */
+static nodo_t* insertNode(nodo_t* r, nodo_t* new, int* res, bool_t w) {
+	nodo_t *path[MAXHEIGHT], *n = r;
+	int d = 0, cmp = 0;
+	while (n != NULL) {
+		if ((cmp = strcmp(n->user.name, new->user.name)) == 0) {
+			(*res) = 1;
+			return r;
 		}
+		path[d++] = n;
+		n = nodeAt((cmp > 0) ? LEFT(n, w) : RIGHT(n, w));
 	}
-	else return FALSE;
+	if (d == 0) return new;
+	if (cmp > 0) LEFT(path[d-1], w) = new->id;
+	else RIGHT(path[d-1], w) = new->id;
+	return rebalancePath(path, d, r, w);
 }
 
-int removeUser(nodo_t** r, user_t* puser) {
-	nodo_t *prec = NULL, *corr = NULL, *temp1 = NULL, *temp2 = NULL;
-	bool_t found = FALSE;
+/** Stacca dall'albero radicato in \c r il nodo \c n, raggiunto attraverso il cammino \c path[0..d-1]
+    (\c path ha spazio per l'intera altezza dell'albero); restituisce la nuova radice */
+static nodo_t* unlinkNode(nodo_t* r, nodo_t** path, int d, nodo_t* n, bool_t w) {
+	nodo_t *min = NULL, *sub = NULL;
+	int k = 0;
+	if (LEFT(n, w) == NONODE || RIGHT(n, w) == NONODE) {
+		/* Al piu' un figlio: il nodo viene sostituito dal figlio stesso */
+		sub = nodeAt((LEFT(n, w) == NONODE) ? RIGHT(n, w) : LEFT(n, w));
+		if (d > 0) setChild(path[d-1], n, sub, w);
+		else r = sub;
+	}
+	else {
+		/* Due figli: il nodo viene sostituito dal minimo del sottoalbero destro,
+		   che prende il suo posto nel cammino da ribilanciare */
+		k = d;
+		path[d++] = n;
+		for (min = nodeAt(RIGHT(n, w)); LEFT(min, w) != NONODE; min = nodeAt(LEFT(min, w))) path[d++] = min;
+		if (d-1 == k) RIGHT(n, w) = RIGHT(min, w);
+		else LEFT(path[d-1], w) = RIGHT(min, w);
+		LEFT(min, w) = LEFT(n, w);
+		RIGHT(min, w) = RIGHT(n, w);
+		if (k > 0) setChild(path[k-1], n, min, w);
+		else r = min;
+		path[k] = min;
+	}
+	return rebalancePath(path, d, r, w);
+}
+
+/** Come \c addUser, ma senza deallocare \c puser; in caso di successo memorizza il nuovo nodo in \c h */
+static int addNode(nodo_t** r, user_t* puser, nodo_t** h) {
+	nodo_t* new = NULL;
+	int res = 0;
 	if (r == NULL || puser == NULL) {
 		errno = EINVAL;
 		return -1;
 	}
-	corr = *r; 
-	while (corr != NULL && !found) {
-		if (strcmp(corr->user->name, puser->name) == 0) {
-			if (strcmp(corr->user->passwd, puser->passwd) == 0) found = TRUE;
-			else return WRPWD;
-		}
-		else {
-			prec = corr;
-			if (strcmp(corr->user->name, puser->name) > 0) corr = corr->left;
-			else corr = corr->right;
-		}
+	if ((new = allocNode()) == NULL) return -1;
+	new->user = *puser;
+	(*r) = insertNode(*r, new, &res, FALSE);
+	if (res == 1) freeNode(new);
+	else if (h != NULL) (*h) = new;
+	return res;
+}
+
+int addUser(nodo_t** r, user_t* puser) {
+	int res = 0;
+	if ((res = addNode(r, puser, NULL)) == 0) free(puser);
+	return res;
+}
+
+bool_t checkPwd(nodo_t* r, user_t* user) {
+	int cmp = 0;
+	while (r != NULL && (cmp = strcmp(r->user.name, user->name)) != 0) r = nodeAt((cmp > 0) ? r->left : r->right);
+	if (r != NULL && strcmp(r->user.passwd, user->passwd) == 0) return TRUE;
+	return FALSE;
+}
+
+/** Stacca l'utente \c puser dall'albero radicato in \c r, memorizzando in \c *res l'esito
+    (0, \c NOUSR o \c WRPWD) e in \c *out il nodo staccato (che non viene deallocato);
+    restituisce la nuova radice */
+static nodo_t* removeNode(nodo_t* r, user_t* puser, int* res, nodo_t** out) {
+	nodo_t *path[MAXHEIGHT], *n = r;
+	int d = 0, cmp = 0;
+	while (n != NULL && (cmp = strcmp(n->user.name, puser->name)) != 0) {
+		path[d++] = n;
+		n = nodeAt((cmp > 0) ? n->left : n->right);
 	}
-	if (!found) return NOUSR;
-	else {
-		 if (corr->left == NULL && corr->right == NULL) {
-			if (prec != NULL) {
-				if (strcmp(prec->user->name, corr->user->name) > 0) prec->left = NULL;
-				else prec->right = NULL;
-			}
-			else (*r) = NULL;
-			free(corr->user);
-			free(corr);
-		}
-		else if (corr->left != NULL && corr->right == NULL) {
-			if (prec != NULL) {
-				if (strcmp(prec->user->name, corr->user->name) > 0) prec->left = corr->left;
-				else prec->right = corr->left;
-			}
-			else (*r) = corr->left;
-			free(corr->user);
-			free(corr);
-		}
-		else if (corr->left == NULL && corr->right != NULL) {
-			if (prec != NULL) {
-				if (strcmp(prec->user->name, corr->user->name) > 0) prec->left = corr->right;
-				else prec->right = corr->right;
-			}
-			else (*r) = corr->right;
-			free(corr->user);
-			free(corr);
-		}
-		else if (corr->left != NULL && corr->right != NULL) {
-			temp1 = corr;
-			temp2 = corr->left;
-			while (temp2->right != NULL) {
-				temp1 = temp2;
-				temp2 = temp2->right;
-			}
-			if (temp2->left != NULL && temp1 != corr) {
-				temp1->right = temp2->left;
-			}
-			else temp1->right = NULL;
-			if (prec != NULL) {
-				if (strcmp(prec->user->name, corr->user->name) > 0) prec->left = temp2;
-				else prec->right = temp2;
-			}
-			else (*r) = temp2;
-			temp2->left = corr->left;
-			temp2->right = corr->right;
-			free(corr->user);
-			free(corr);
-		}
-		return 0;
+	if (n == NULL) {
+		(*res) = NOUSR;
+		return r;
+	}
+	if (strcmp(n->user.passwd, puser->passwd) != 0) {
+		(*res) = WRPWD;
+		return r;
 	}
+	r = unlinkNode(r, path, d, n, FALSE);
+	(*out) = n;
+	(*res) = 0;
+	return r;
 }
 
-void freeTree(nodo_t* r) {
-	if (r != NULL) {
-		freeTree(r->left);
-		freeTree(r->right);
-		free(r->user);
-		free(r);
+int removeUser(nodo_t** r, user_t* puser) {
+	nodo_t* n = NULL;
+	int res = 0;
+	if (r == NULL || puser == NULL) {
+		errno = EINVAL;
+		return -1;
 	}
+	(*r) = removeNode(*r, puser, &res, &n);
+	if (res == 0) freeNode(n);
+	return res;
+}
+
+void freeTree(nodo_t* r) {
+	visit_t v;
+	visitBegin(&v, r, FALSE);
+	while ((r = visitNext(&v)) != NULL) freeNode(r);
+}
+
+/** Dimensione dei blocchi letti da \c loadUsers */
+#define LOADCHUNK 65536
+
+/** Collega in un albero perfettamente bilanciato i nodi \c v[lo..hi-1], ordinati in modo
+    strettamente crescente; restituisce la radice (\c NULL se l'intervallo e' vuoto) */
+static nodo_t* buildTree(nodeid_t* v, int lo, int hi) {
+	nodo_t *new = NULL, *sub = NULL;
+	int mid = lo + (hi - lo)/2;
+	if (lo >= hi) return NULL;
+	new = nodeAt(v[mid]);
+	sub = buildTree(v, lo, mid);
+	new->left = (sub == NULL) ? NONODE : sub->id;
+	sub = buildTree(v, mid+1, hi);
+	new->right = (sub == NULL) ? NONODE : sub->id;
+	fixHeight(new, FALSE);
+	return new;
+}
+
+/** Restituisce all'arena i nodi \c v[0..n-1] e dealloca il vettore stesso */
+static void freeVector(nodeid_t* v, int n) {
+	int i;
+	for (i = 0; i < n; i++) freeNode(nodeAt(v[i]));
+	free(v);
 }
 
 int loadUsers(FILE* fin, nodo_t** r) {
-	int n = 0, res = 0, len = 0;
-	char temp1[LUSER+LPWD+3], temp2[LUSER+LPWD+3], *firstseq = NULL, *scorri = NULL;
-	user_t* tmp = NULL;
-	scorri = fgets(temp1, LUSER+LPWD+3, fin);
-	while (scorri != NULL) {
-		len = strlen(temp1);
-		firstseq = strchr(temp1, '\n');
-		if (firstseq == NULL) {
+	int n = 0, res = 0, len = 0, size = 0, nv = 0, maxv = 0, i = 0;
+	size_t got = 0;
+	char *buf = NULL, *tmpbuf = NULL, *line = NULL, *end = NULL;
+	nodo_t *tmp = NULL, *prev = NULL;
+	nodeid_t *v = NULL, *tmpv = NULL;
+	bool_t sorted = TRUE;
+	
+	/* Lettura dell'intero file a blocchi */
+	do {
+		if (len + LOADCHUNK > size) {
+			size = (size == 0) ? LOADCHUNK : 2*size;
+			if ((tmpbuf = (char*)realloc(buf, size+1)) == NULL) {
+				free(buf);
+				return -1;
+			}
+			buf = tmpbuf;
+		}
+		got = fread(buf+len, 1, size-len, fin);
+		len += got;
+	} while (got > 0);
+	if (ferror(fin)) {
+		free(buf);
+		return -1;
+	}
+	
+	/* Conversione delle righe in nodi dell'arena, controllando se sono gia' ordinate */
+	for (line = buf; line < buf+len; line = end+1) {
+		if ((end = memchr(line, '\n', buf+len-line)) == NULL || end-line > LUSER+LPWD+1) {
+			freeVector(v, nv);
+			free(buf);
 			errno = EINVAL;
 			return -1;
 		}
-		len = firstseq - temp1;
-		strncpy(temp2, temp1, len);
-		temp2[len] = '\0';
-		tmp = stringToUser(temp2, LUSER+LPWD+3);
-		if (tmp == NULL) return -1;
-		res = addUser(r, tmp);
-		if (res == -1) return -1;
-		n++;
-		scorri = fgets(temp1, LUSER+LPWD+3, fin);
+		*end = '\0';
+		if (nv == maxv) {
+			maxv = (maxv == 0) ? 1024 : 2*maxv;
+			if ((tmpv = (nodeid_t*)realloc(v, maxv*sizeof(nodeid_t))) == NULL) {
+				freeVector(v, nv);
+				free(buf);
+				return -1;
+			}
+			v = tmpv;
+		}
+		if ((tmp = allocNode()) == NULL) {
+			freeVector(v, nv);
+			free(buf);
+			return -1;
+		}
+		if (parseUser(line, end-line+1, &(tmp->user)) == -1) {
+			freeNode(tmp);
+			freeVector(v, nv);
+			free(buf);
+			return -1;
+		}
+		if (prev != NULL && strcmp(prev->user.name, tmp->user.name) >= 0) sorted = FALSE;
+		v[nv++] = tmp->id;
+		prev = tmp;
+	}
+	free(buf);
+	
+	/* Input ordinato e albero vuoto: costruzione diretta dell'albero bilanciato in tempo lineare */
+	if (sorted && (*r) == NULL) {
+		(*r) = buildTree(v, 0, nv);
+		free(v);
+		return nv;
 	}
+	
+	/* Altrimenti, inserimento dei singoli nodi */
+	for (i = 0; i < nv; i++) {
+		tmp = nodeAt(v[i]);
+		res = 0;
+		(*r) = insertNode(*r, tmp, &res, FALSE);
+		if (res == 1) freeNode(tmp);	/* Utente gia' presente */
+		else n++;
+	}
+	free(v);
 	return n;
 }
 
 int storeUsers(FILE* fout, nodo_t* r) {
-	if (r != NULL) {
-		int a = 0, b = 0;
-		a = storeUsers(fout, r->left);
-		if (r->user != NULL) fprintf(fout, "%s:%s\n", r->user->name, r->user->passwd);
-		else {
-			errno = EINVAL;
-			return -1;
-		}
-		b = storeUsers(fout, r->right);
-		if (a == -1 || b == -1) return -1;
-		return 1+a+b;
+	visit_t v;
+	int n = 0;
+	visitBegin(&v, r, FALSE);
+	while ((r = visitNext(&v)) != NULL) {
+		if (fprintf(fout, "%s:%s\n", r->user.name, r->user.passwd) < 0) return -1;
+		n++;
 	}
-	else return 0;
+	return n;
 }
 
 /** 
@@ -250,12 +529,10 @@ int storeUsers(FILE* fout, nodo_t* r) {
  */
 
 static nodo_t* searchUser(nodo_t* r, char* u) {
-	if (r != NULL && u != NULL) {
-		if (strcmp(r->user->name, u) == 0) return r;
-		if (strcmp(r->user->name, u) > 0) return searchUser(r->left, u);
-		if (strcmp(r->user->name, u) < 0) return searchUser(r->right, u);
-	}
-	return NULL;
+	int cmp = 0;
+	if (u == NULL) return NULL;
+	while (r != NULL && (cmp = strcmp(r->user.name, u)) != 0) r = nodeAt((cmp > 0) ? r->left : r->right);
+	return r;
 }
 
 status_t getUserStatus(nodo_t* r, char* u) {
@@ -299,50 +576,336 @@ bool_t isUser(nodo_t* r, char* u) {
 	else return TRUE;
 }
 
+/** Dimensione minima del buffer delle liste di utenti */
+#define MINLIST 256
+
+/** Accoda lo username \c u (preceduto da ':' se la lista non e' vuota) alla lista lunga \c *len
+    contenuta in \c *buf, di dimensione \c *size, raddoppiando il buffer se necessario;
+    restituisce 0, o -1 se si e' verificato un errore (setta \c errno) */
+static int appendName(char** buf, size_t* size, size_t* len, char* u) {
+	size_t l = strlen(u), need;
+	char* tmp = NULL;
+	need = (*len) + ((*len) > 0) + l + 1;
+	if (need > (*size)) {
+		size_t n = ((*size) < MINLIST) ? MINLIST : (*size);
+		while (n < need) n *= 2;
+		if ((tmp = (char*)realloc(*buf, n)) == NULL) return -1;
+		(*buf) = tmp;
+		(*size) = n;
+	}
+	if ((*len) > 0) (*buf)[(*len)++] = ':';
+	memcpy((*buf)+(*len), u, l+1);
+	(*len) += l;
+	return 0;
+}
+
+int getUserListBuf(nodo_t* r, status_t st, char** buf, size_t* size) {
+	visit_t v;
+	size_t len = 0;
+	if (buf == NULL || size == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((*buf) != NULL && (*size) > 0) (*buf)[0] = '\0';
+	visitBegin(&v, r, FALSE);
+	while ((r = visitNext(&v)) != NULL)
+		if (r->status == st && appendName(buf, size, &len, r->user.name) == -1) return -1;
+	return len;
+}
+
 char* getUserList(nodo_t* r, status_t st) {
-	if (r != NULL) {
-		char *left_string = NULL, *right_string = NULL, *s = NULL;
-		int a=0, b=0, c=0;
-		left_string = getUserList(r->left, st);
-		if (left_string != NULL) a = strlen(left_string) + 1;
-		right_string = getUserList(r->right, st);
-		if (right_string != NULL) b = strlen(right_string) + 1;
-		if (r->status == st) c = strlen(r->user->name) + 1 ;
-		s = (char*)malloc((a+b+c)*sizeof(char));
-		if (left_string == NULL && right_string == NULL) {
-			if (r->status == st) strcpy(s,r->user->name);
-			else {
-				free(s);
-				s = NULL;
+	char* s = NULL;
+	size_t size = 0;
+	if (getUserListBuf(r, st, &s, &size) <= 0) {
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+nodo_t* findUser(nodo_t* r, char* u) {
+	return searchUser(r, u);
+}
+
+/** Numero minimo di liste dell'indice hash */
+#define MINBUCKETS 64
+
+/** Hash FNV-1a di uno username (al piu' \c LUSER caratteri) */
+static unsigned int hashName(char* u) {
+	unsigned int h = 2166136261U;
+	int i;
+	for (i = 0; i < LUSER && u[i] != '\0'; i++) {
+		h ^= (unsigned char)u[i];
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/** Collegamento al successivo di un nodo nelle liste della tabella \c t */
+#define HNEXT(n, t) ((n)->hnext[(t)->gen & 1])
+
+/** Inserisce un nodo nell'indice hash (la tabella deve essere gia' allocata); il nodo
+    diventa visibile ai lettori senza lock solo quando e' completamente collegato */
+static void indexNode(userdb_t* db, nodo_t* h) {
+	hindex_t* t = db->index;
+	unsigned int i;
+	h->hash = hashName(h->user.name);
+	i = h->hash & (t->nbuckets - 1);
+	HNEXT(h, t) = t->buckets[i];
+	__atomic_store_n(&(t->buckets[i]), h->id, __ATOMIC_RELEASE);
+	db->nusers++;
+}
+
+/** Rimuove un nodo dall'indice hash; il collegamento del nodo al successivo resta
+    intatto, per cui un lettore che vi si trova puo' proseguire lungo la lista */
+static void unindexNode(userdb_t* db, nodo_t* h) {
+	hindex_t* t = db->index;
+	nodeid_t* p = &(t->buckets[h->hash & (t->nbuckets - 1)]);
+	while ((*p) != NONODE && (*p) != h->id) p = &HNEXT(nodeAt(*p), t);
+	if ((*p) != NONODE) {
+		__atomic_store_n(p, HNEXT(h, t), __ATOMIC_RELEASE);
+		db->nusers--;
+	}
+}
+
+/** Porta la tabella dell'indice hash ad almeno \c n liste, reinserendo i nodi gia' indicizzati.
+    Le nuove liste usano l'altro collegamento dei nodi, per cui quelle della tabella corrente
+    restano percorribili finche' la nuova non e' pubblicata; la vecchia tabella e' deallocata
+    dopo un periodo di grazia, che rende anche riusabili i collegamenti delle sue liste */
+static int resizeIndex(userdb_t* db, unsigned int n) {
+	hindex_t *old = db->index, *new = NULL;
+	nodo_t* tmp = NULL;
+	unsigned int size = MINBUCKETS, i;
+	while (size < n) size *= 2;
+	if (old != NULL && size <= old->nbuckets) return 0;
+	if ((new = (hindex_t*)calloc(1, sizeof(hindex_t) + size*sizeof(nodeid_t))) == NULL) return -1;
+	new->nbuckets = size;
+	new->gen = (old == NULL) ? 0 : old->gen + 1;
+	if (old != NULL) {
+		for (i = 0; i < old->nbuckets; i++) {
+			for (tmp = nodeAt(old->buckets[i]); tmp != NULL; tmp = nodeAt(HNEXT(tmp, old))) {
+				HNEXT(tmp, new) = new->buckets[tmp->hash & (size - 1)];
+				new->buckets[tmp->hash & (size - 1)] = tmp->id;
 			}
 		}
-		else if (left_string != NULL && right_string == NULL) {
-			strcpy(s, left_string);
-			if (r->status == st) {
-				strcat(s, ":");
-				strcat(s, r->user->name);
-			}
+	}
+	__atomic_store_n(&(db->index), new, __ATOMIC_RELEASE);
+	if (old != NULL) {
+		epochBarrier();
+		free(old);
+	}
+	return 0;
+}
+
+/** Inserisce nell'indice hash tutti i nodi di un sottoalbero */
+static void indexTree(userdb_t* db, nodo_t* r) {
+	visit_t v;
+	visitBegin(&v, r, FALSE);
+	while ((r = visitNext(&v)) != NULL) indexNode(db, r);
+}
+
+/** Conta i nodi di un sottoalbero */
+static unsigned int countTree(nodo_t* r) {
+	visit_t v;
+	unsigned int n = 0;
+	visitBegin(&v, r, FALSE);
+	while (visitNext(&v) != NULL) n++;
+	return n;
+}
+
+nodo_t* findUserDb(userdb_t* db, char* u) {
+	hindex_t* t = NULL;
+	nodo_t* tmp = NULL;
+	unsigned int hv;
+	if (u == NULL || (t = __atomic_load_n(&(db->index), __ATOMIC_ACQUIRE)) == NULL) return NULL;
+	hv = hashName(u);
+	for (tmp = nodeAt(__atomic_load_n(&(t->buckets[hv & (t->nbuckets - 1)]), __ATOMIC_ACQUIRE)); tmp != NULL;
+	     tmp = nodeAt(__atomic_load_n(&HNEXT(tmp, t), __ATOMIC_ACQUIRE)))
+		if (tmp->hash == hv && strcmp(tmp->user.name, u) == 0) return tmp;
+	return NULL;
+}
+
+int addUserDb(userdb_t* db, user_t* puser) {
+	nodo_t* h = NULL;
+	int res = 0;
+	if (db == NULL || puser == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((db->index == NULL || db->nusers + 1 > db->index->nbuckets) && resizeIndex(db, db->nusers + 1) == -1) return -1;
+	/* Riciclo dei nodi rimossi il cui periodo di grazia e' terminato */
+	epochReclaim();
+	if ((res = addNode(&(db->root), puser, &h)) == 0) {
+		indexNode(db, h);
+		free(puser);
+	}
+	return res;
+}
+
+int loadUsersDb(FILE* fin, userdb_t* db) {
+	int res = 0;
+	res = loadUsers(fin, &(db->root));
+	/* Ricostruzione dell'indice a partire dall'albero */
+	if (db->index != NULL) memset(db->index->buckets, 0, db->index->nbuckets*sizeof(nodeid_t));
+	db->nusers = 0;
+	if (resizeIndex(db, countTree(db->root)) == -1) return -1;
+	indexTree(db, db->root);
+	return res;
+}
+
+void freeUserDb(userdb_t* db) {
+	hindex_t* t = db->index;
+	__atomic_store_n(&(db->index), NULL, __ATOMIC_RELEASE);
+	/* Attesa dei lettori e riciclo dei nodi rimossi in precedenza */
+	epochBarrier();
+	freeTree(db->root);
+	free(t);
+	db->root = NULL;
+	db->lobby = NULL;
+	db->nlobby = 0;
+	db->lobbyver++;
+	db->nusers = 0;
+}
+
+void changeStatus(userdb_t* db, nodo_t* h, status_t st) {
+	nodo_t *path[MAXHEIGHT], *n = db->lobby;
+	int d = 0, res = 0;
+	if (h->status == WAITING && st != WAITING) {
+		/* Ricerca del cammino dalla radice della lobby al nodo, e rimozione */
+		while (n != NULL && n != h) {
+			path[d++] = n;
+			n = nodeAt((strcmp(n->user.name, h->user.name) > 0) ? n->wleft : n->wright);
 		}
-		else if (left_string == NULL && right_string != NULL) {
-			if (r->status == st) {
-				strcpy(s, r->user->name);
-				strcat(s, ":");
-				strcat(s, right_string);
-			}
-			else strcpy(s, right_string);
+		if (n != NULL) {
+			db->lobby = unlinkNode(db->lobby, path, d, h, TRUE);
+			db->nlobby--;
+			db->lobbyver++;
 		}
-		else if (left_string != NULL && right_string != NULL) {
-			strcpy(s, left_string);
-			if (r->status == st) {	
-				strcat(s, ":");
-				strcat(s, r->user->name);
-			}
-			strcat(s, ":");
-			strcat(s, right_string);
+	}
+	else if (h->status != WAITING && st == WAITING) {
+		h->wleft = NONODE;
+		h->wright = NONODE;
+		h->wheight = 1;
+		h->wcount = 1;
+		db->lobby = insertNode(db->lobby, h, &res, TRUE);
+		db->nlobby++;
+		db->lobbyver++;
+	}
+	__atomic_store_n(&(h->status), st, __ATOMIC_RELAXED);
+}
+
+bool_t setUserStatusDb(userdb_t* db, char* u, status_t st) {
+	nodo_t* tmp = NULL;
+	tmp = findUserDb(db, u);
+	if (tmp == NULL) return FALSE;
+	changeStatus(db, tmp, st);
+	return TRUE;
+}
+
+/** Ricicla un nodo rimosso dall'archivio al termine del periodo di grazia */
+static void retireNode(void* n) {
+	freeNode((nodo_t*)n);
+}
+
+int removeUserDb(userdb_t* db, user_t* puser) {
+	nodo_t *tmp = NULL, *n = NULL;
+	int res = 0;
+	if (db == NULL || puser == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	tmp = findUserDb(db, puser->name);
+	if (tmp != NULL && strcmp(tmp->user.passwd, puser->passwd) == 0) {
+		changeStatus(db, tmp, DISCONNECTED);
+		unindexNode(db, tmp);
+	}
+	db->root = removeNode(db->root, puser, &res, &n);
+	if (res == 0) epochRetire(n, retireNode);
+	return res;
+}
+
+int getLobbyListBuf(userdb_t* db, char** buf, size_t* size) {
+	return getLobbyPage(db, NULL, 0, db->nlobby, buf, size);
+}
+
+int getLobbyPage(userdb_t* db, char* prefix, unsigned int offset, unsigned int limit, char** buf, size_t* size) {
+	visit_t v;
+	nodo_t *n = NULL;
+	unsigned int k = 0, l = 0;
+	size_t len = 0, plen = 0;
+	if (db == NULL || buf == NULL || size == NULL) {
+		errno = EINVAL;
+		return -1;
+	}
+	if ((*buf) != NULL && (*size) > 0) (*buf)[0] = '\0';
+	if (prefix != NULL) plen = strlen(prefix);
+	/* Posizione del primo utente con nome >= prefix */
+	for (n = db->lobby; plen > 0 && n != NULL; ) {
+		if (strcmp(n->user.name, prefix) < 0) {
+			k += wcount(n->wleft) + 1;
+			n = nodeAt(n->wright);
 		}
-		if (left_string != NULL) free(left_string);
-		if (right_string != NULL) free(right_string);
-		return s;
+		else n = nodeAt(n->wleft);
+	}
+	/* Discesa fino all'utente di posizione k + offset, impilando i nodi da visitare dopo di esso */
+	k += offset;
+	v.top = 0;
+	v.w = TRUE;
+	for (n = db->lobby; n != NULL; ) {
+		l = wcount(n->wleft);
+		if (k <= l) v.stack[v.top++] = n;
+		if (k == l) break;
+		if (k < l) n = nodeAt(n->wleft);
+		else {
+			k -= l + 1;
+			n = nodeAt(n->wright);
+		}
+	}
+	/* Copia di al piu' limit utenti, finche' il nome inizia con prefix */
+	while (limit > 0 && (n = visitNext(&v)) != NULL && strncmp(n->user.name, prefix == NULL ? "" : prefix, plen) == 0) {
+		if (appendName(buf, size, &len, n->user.name) == -1) return -1;
+		limit--;
+	}
+	return len;
+}
+
+char* getLobbyList(userdb_t* db) {
+	char* s = NULL;
+	size_t size = 0;
+	errno = 0;
+	if (getLobbyListBuf(db, &s, &size) <= 0) {
+		free(s);
+		return NULL;
+	}
+	return s;
+}
+
+int connectUser(userdb_t* db, nodo_t* h, user_t* puser, status_t st, int ch) {
+	if (h == NULL) return NOUSR;
+	if (strcmp(h->user.passwd, puser->passwd) != 0) return WRPWD;
+	if (h->status != DISCONNECTED || h->channel != -1) return ALRCONN;
+	changeStatus(db, h, st);
+	__atomic_store_n(&(h->channel), ch, __ATOMIC_RELAXED);
+	return 0;
+}
+
+int claimUser(userdb_t* db, char* u, nodo_t** h) {
+	nodo_t* tmp = NULL;
+	tmp = findUserDb(db, u);
+	if (tmp == NULL || tmp->status != WAITING) return NOUSR;
+	changeStatus(db, tmp, PLAYING);
+	(*h) = tmp;
+	return tmp->channel;
+}
+
+void updateUser(userdb_t* db, nodo_t* h, status_t st, int ch) {
+	changeStatus(db, h, st);
+	__atomic_store_n(&(h->channel), ch, __ATOMIC_RELAXED);
+}
+
+void releaseUser(userdb_t* db, nodo_t* h, int ch) {
+	if (h->channel == ch) {
+		changeStatus(db, h, DISCONNECTED);
+		__atomic_store_n(&(h->channel), -1, __ATOMIC_RELAXED);
 	}
-	else return NULL;
 }
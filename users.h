@@ -22,6 +22,8 @@
 #define NOUSR -2
 /** Errore password errata */
 #define WRPWD -3
+/** Errore utente gia' connesso */
+#define ALRCONN -4
 
 /** Tipo connessione...
    DISCONNECTED disconnesso
@@ -38,24 +40,96 @@ typedef struct user {
   char passwd[LPWD + 1];
 } user_t;
 
+/** Indice di un nodo nell'arena dei nodi (\c NONODE se il nodo non esiste) */
+typedef unsigned int nodeid_t;
+/** Indice nullo: nessun nodo */
+#define NONODE 0
+
 /** Nodo dell'albero che rappresenta l'utente registrato al servizio,
     ogni utente puo' essere connesso o disconnesso e se connesso puo'
     essere in attesa di una sfida o coinvolto in una partita -- 
     l'albero e' un albero di ricerca ordinato lessicograficamente (strcmp()) 
-    rispetto al campo user */
+    rispetto al campo user, bilanciato secondo i criteri degli alberi AVL
+    (le altezze dei due sottoalberi di ogni nodo differiscono al piu' di 1).
+    I nodi sono allocati a blocchi da un'arena comune a tutti gli alberi e non vengono mai
+    spostati in memoria; i collegamenti fra nodi sono indici a 32 bit nell'arena e i dati
+    utente sono contenuti nel nodo stesso. */
 typedef struct nodo {
   /** Dati utente */
-  user_t* user;
+  user_t user;
+  /** Altezza del sottoalbero radicato nel nodo (1 per le foglie) */
+  unsigned char height;
+  /** Altezza del sottoalbero della lobby radicato nel nodo (significativo solo se \c status == \c WAITING) */
+  unsigned char wheight;
   /** Stato di connessione in partita */
   status_t status;  
   /** Canale di comunicazione, significativo solo se connesso altrimenti (-1)*/
   int channel;
-  /** Figlio destro */  
-  struct nodo* left;       
-  /** Figlio sinistro */ 
-  struct nodo* right;      
+  /** Indice del nodo nell'arena */
+  nodeid_t id;
+  /** Figlio sinistro */  
+  nodeid_t left;       
+  /** Figlio destro */ 
+  nodeid_t right;      
+  /** Figlio sinistro nella lobby (significativo solo se \c status == \c WAITING) */
+  nodeid_t wleft;
+  /** Figlio destro nella lobby (significativo solo se \c status == \c WAITING) */
+  nodeid_t wright;
+  /** Numero di nodi del sottoalbero della lobby radicato nel nodo (significativo solo se \c status == \c WAITING) */
+  unsigned int wcount;
+  /** Nodo successivo nella lista di trabocco dell'indice hash: la tabella di generazione \c g
+      usa \c hnext[g % 2], per cui un ridimensionamento costruisce le nuove liste senza
+      toccare quelle percorse dai lettori della tabella corrente */
+  nodeid_t hnext[2];
+  /** Hash dello username (significativo solo se il nodo e' indicizzato in un \c userdb_t) */
+  unsigned int hash;
 } nodo_t;
 
+/** Tabella dell'indice hash degli utenti */
+typedef struct hindex {
+  /** Numero di liste della tabella (potenza di 2) */
+  unsigned int nbuckets;
+  /** Generazione della tabella, incrementata ad ogni ridimensionamento */
+  unsigned int gen;
+  /** Nodi di testa delle liste di trabocco */
+  nodeid_t buckets[];
+} hindex_t;
+
+/** Archivio degli utenti: albero di ricerca, indice hash e lobby degli utenti in attesa.
+    L'albero resta la struttura usata per le visite ordinate (\c storeUsers, \c getUserList),
+    mentre le ricerche puntuali per username passano dall'indice hash (a liste di trabocco,
+    i cui collegamenti sono nei nodi stessi), mantenuto da \c addUserDb, \c removeUserDb e
+    \c loadUsersDb.
+    Le ricerche tramite l'indice (\c findUserDb) possono procedere senza lock in concorrenza
+    con una modifica dell'archivio, purche' all'interno di una sezione di lettura (\c epochEnter,
+    \c epochExit): la tabella viene pubblicata con un'unica scrittura atomica, un nodo e'
+    reso raggiungibile solo dopo essere stato completamente inizializzato e i nodi rimossi
+    (o le tabelle sostituite) vengono riciclati solo al termine del periodo di grazia.
+    Le modifiche restano mutuamente esclusive fra loro e con le visite degli alberi.
+    La lobby e' un secondo albero AVL, ordinato lessicograficamente, dei soli nodi con
+    \c status == \c WAITING (i collegamenti sono nei nodi stessi), in cui ogni nodo conosce
+    la dimensione del proprio sottoalbero: l'utente in una qualsiasi posizione si trova quindi
+    in tempo logaritmico, e una pagina della lobby costa O(log n + dimensione della pagina).
+    La lobby e' aggiornata ad ogni cambiamento di stato effettuato con le funzioni che
+    ricevono l'archivio come parametro. */
+typedef struct userdb {
+  /** Radice dell'albero degli utenti */
+  nodo_t* root;
+  /** Radice dell'albero della lobby */
+  nodo_t* lobby;
+  /** Numero di utenti nella lobby */
+  int nlobby;
+  /** Versione della lobby, incrementata ogni volta che un utente vi entra o ne esce */
+  unsigned long lobbyver;
+  /** Tabella dell'indice hash (\c NULL se l'archivio e' vuoto) */
+  hindex_t* index;
+  /** Numero di utenti indicizzati */
+  unsigned int nusers;
+} userdb_t;
+
+/** Inizializzatore statico di un archivio vuoto */
+#define USERDB_INITIALIZER { NULL, NULL, 0, 0, NULL, 0 }
+
 /** A partire da una stringa \c nome_user:password crea una nuova struttura utente allocando la memoria
     corrispondente ed inserendo utente e password nei rispettivi campi.
     
@@ -87,9 +161,13 @@ char* userToString(user_t* puser);
 void printTree(nodo_t* r);
 
 /** Aggiunge un nuovo utente all'albero mantenendolo ordinato lessicograficamente rispetto al campo users (ordinamento di strcmp). Se l'utente e' gia' presente non viene inserito.
+ Dopo l'inserimento l'albero viene ribilanciato con rotazioni lungo il cammino di ricerca, per cui anche l'inserimento di utenti gia' ordinati (come in \c loadUsers) produce un albero di altezza O(log n).
+
+ I dati utente vengono copiati nel nuovo nodo: se l'inserzione va a buon fine la struttura
+ \c puser viene deallocata, altrimenti resta al chiamante.
 
  \param r puntatore alla radice dell'albero
- \param puser puntatore utente da inserire
+ \param puser puntatore utente da inserire (allocato con \c malloc)
 
  \retval 0 se l'inserzione e' andata a buon fine
  \retval 1 se l'utente e' gia' presente
@@ -119,70 +197,25 @@ e' presente e la password coincide).
 \retval 0 se la rimozione e' avvenuta correttamente
 \retval -1 se si e' verificato un errore (setta \c errno)
 \section commentiagg Commenti Aggiuntivi
-\subsection parte1 Parte 1: ricerca del nodo da rimuovere
-Mediante due puntatori e un booleano, scorro l'albero
-fino a trovare il nodo da rimuovere. Se lo trovo e le
-password coincidono, setto \c found a \c <b>TRUE</b>; se le password
-non coincidono, restituisco \c <b>WRPWD</b>. Se alla fine della visita 
-dell'albero \c found è \c <b>FALSE</b>, l'utente non esiste nell'albero e 
-dunque restituisco \c <b>NOUSR</b>. Se l'utente esiste e <tt>found == <b>TRUE</b></tt>, 
-\c corr punta all'elemento da rimuovere e \c prec è il suo predecessore.
-
-\snippet removeuser-snippets.c Parte1
-
-\n
-
-\subsection parte2 Parte 2: rimozione effettiva del nodo 
-In linea generale, per rimuovere un nodo e' necessario trovare un altro
-nodo (discendente di quello da rimuovere) che, sostituito al primo,
-mantiene le proprietà di ricerca dell'albero. Tale processo e' semplificato
-se il nodo da rimuovere è una foglia oppure ha un solo sottoalbero.
-\subsubsection p2caso1 Caso 1: il nodo da rimuovere è una foglia
-Controllo se il predecessore è \c <b>NULL</b>; se sì, vuol dire che il
-nodo da rimuovere è proprio la radice. 
-Se <tt>prec != <b>NULL</b></tt>, controllo se \c corr è figlio sinistro
-o destro di \c prec e aggiorno i puntatori a \c <b>NULL</b> di
-conseguenza.
-
-\snippet removeuser-snippets.c Parte2Sez1
-
-\subsubsection p2caso2a Caso 2a: il nodo da rimuovere ha solo il figlio sinistro
-Se <tt>prec == <b>NULL</b></tt>, \c corr è la radice e dunque basta porre
-\c corr->left come nuova radice.
-Se <tt>prec != <b>NULL</b></tt>, controllo se \c corr è figlio sinistro o
-destro di \c prec, dopodiché aggiorno il puntatore giusto
-in modo che punti a \c corr->left.
-
-\snippet removeuser-snippets.c Parte2Sez2a
-\subsubsection p2caso2b Caso 2b: il nodo da rimuovere ha solo il figlio destro
-Analogo al precedente.
-
-\snippet removeuser-snippets.c Parte2Sez2b
-
-\subsubsection p2caso3 Caso 3: il nodo da rimuovere ha entrambi i figli
-Con due nuovi puntatori, \c temp1 e \c temp2, visito il
-sottoalbero sinistro di \c corr fino a trovarne il massimo
-(foglia più a destra del sottoalbero radicato in \c corr->left ).
-Scambiando tale foglia con il nodo da rimuovere si manterrà
-la proprietà di ricerca dell'albero.
-Tale massimo esiste sempre (al limite è proprio il figlio sinistro
-di \c corr ); dunque alla fine della visita avrò che \c temp2 è il massimo
-del sottoalbero sinistro di \c corr e \c temp1 è il suo predecessore.
-Procedo dunque ad aggiornare i puntatori, "agganciando" il sottoalbero
-destro di \c corr a \c temp2 e ponendo \c temp2 come nuovo figlio sinistro/destro
-di \c prec (se <tt>prec != <b>NULL</b></tt>, altrimenti \c temp2 è la nuova radice).
-
-\snippet removeuser-snippets.c Parte2Sez3
-\note La scelta di prendere il massimo del sottoalbero sinistro
-come nodo che mantiene le proprietà di ricerca è arbitraria, infatti
-anche il minimo del sottoalbero sinistro (foglia più a sinistra del
-sottoalbero radicato in \c corr->right ) mantiene la stessa proprietà.
+La ricerca del nodo da rimuovere avviene iterativamente lungo il cammino dalla
+radice, memorizzato in una pila esplicita. Se il nodo ha al piu' un figlio, viene sostituito dal figlio stesso;
+se ha entrambi i figli, viene sostituito dal minimo del sottoalbero destro,
+che viene prima staccato dalla sua posizione. In entrambi i casi i nodi sono
+ricollegati e mai copiati, per cui i puntatori ai nodi degli altri utenti
+(restituiti da \c findUser) restano validi. Risalendo il cammino, ogni nodo
+attraversato viene ribilanciato con le rotazioni AVL. Il nodo rimosso viene
+restituito alla lista libera dell'arena e riusato dal successivo inserimento.
 */
 int removeUser(nodo_t** r, user_t* puser);
 
 
 
-/** Dealloca l'albero.
+/** Dealloca l'albero, restituendone i nodi all'arena (i blocchi dell'arena vengono
+    liberati quando non contengono piu' alcun nodo in uso).
+
+ Le funzioni che allocano o liberano nodi (\c addUser, \c removeUser, \c freeTree,
+ \c loadUsers e le corrispondenti sugli archivi) non devono essere eseguite in
+ concorrenza, anche su alberi diversi.
 
  \param r radice dell'albero da deallocare
 */
@@ -234,7 +267,8 @@ status_t getUserStatus(nodo_t* r, char* u);
 */
 int getUserChannel(nodo_t* r, char* u);
 
-/** Setta lo stato di un utente (se esiste).
+/** Setta lo stato di un utente (se esiste). La funzione opera sul solo albero e non
+    aggiorna la lobby: per gli alberi gestiti da un \c userdb_t usare \c setUserStatusDb.
  \param r radice dell'albero
  \param u  utente da cercare
  \param s stato da settare 
@@ -273,12 +307,203 @@ Fornisce la lista degli utenti connessi sull'albero con <tt>stato == st</tt>.
 \retval NULL se non ci sono utenti nello stato richiesto
 
 \section commentiagg2 Commenti Aggiuntivi
-Ho implementato la funzione ricorsivamente, strutturandola come una
-visita posticipata; la funzione opera poi concatenando
-tra loro la stringa generata dalla visita del sottoalbero sinistro
-(se esiste), lo username dell'utente del nodo corrente (se il suo status è
-\c st) e la stringa generata dalla visita del sottoalbero destro (se
-esiste).
+La funzione alloca un nuovo buffer e lo riempie con \c getUserListBuf.
  */
 char *  getUserList(nodo_t* r, status_t st);
+
+/** Come \c getUserList, ma scrive la lista in un buffer fornito dal chiamante, che viene
+    ingrandito (raddoppiandone la dimensione) solo se non e' sufficiente: chi costruisce
+    spesso la lista puo' riusare lo stesso buffer fra una chiamata e l'altra.
+    La lista e' costruita con un'unica visita simmetrica iterativa, copiando una sola volta
+    lo username di ogni utente con status \c st.
+
+\param r radice dell'albero
+\param st stato da ricercare
+\param buf puntatore al buffer (allocato con \c malloc, oppure \c NULL)
+\param size puntatore alla dimensione del buffer (0 se \c *buf == \c NULL)
+
+\retval n la lunghezza della lista in \c *buf (0 se non ci sono utenti nello stato richiesto)
+\retval -1 se si e' verificato un errore (setta \c errno); il buffer resta valido e va deallocato dal chiamante
+ */
+int getUserListBuf(nodo_t* r, status_t st, char** buf, size_t* size);
+
+/** Cerca un utente e restituisce il nodo che lo contiene, da usare come handle nelle
+    funzioni seguenti. Il nodo resta valido finche' l'utente non viene rimosso dall'albero
+    (i nodi non vengono mai copiati o spostati in memoria).
+
+ \param r radice dell'albero
+ \param u utente da cercare
+
+ \retval h nodo dell'utente
+ \retval NULL se non e' presente
+*/
+nodo_t* findUser(nodo_t* r, char* u);
+
+/** Cerca un utente nell'archivio tramite l'indice hash. Puo' essere chiamata senza lock
+    all'interno di una sezione di lettura (\c epochEnter, \c epochExit): il nodo restituito
+    resta valido fino alla fine della sezione, e i campi \c status e \c channel vanno letti
+    con un accesso atomico.
+
+ \param db archivio degli utenti
+ \param u utente da cercare
+
+ \retval h nodo dell'utente
+ \retval NULL se non e' presente
+*/
+nodo_t* findUserDb(userdb_t* db, char* u);
+
+/** Aggiunge un nuovo utente all'archivio (albero e indice hash). Se l'utente e' gia'
+    presente non viene inserito.
+
+ \param db archivio degli utenti
+ \param puser puntatore utente da inserire (deallocato se l'inserzione va a buon fine, come in \c addUser)
+
+ \retval 0 se l'inserzione e' andata a buon fine
+ \retval 1 se l'utente e' gia' presente
+ \retval -1 se si e' verificato un errore (setta \c errno)
+*/
+int addUserDb(userdb_t* db, user_t* puser);
+
+/** Legge il file degli utenti (come \c loadUsers) e ricostruisce l'indice hash dell'archivio.
+
+ \param fin il file di ingresso
+ \param db archivio degli utenti
+
+ \retval n il numero di utenti letti ed inseriti nell'archivio se tutto e' andato a buon fine
+ \retval -1 se si e' verificato un errore (setta \c errno)
+*/
+int loadUsersDb(FILE* fin, userdb_t* db);
+
+/** Dealloca l'albero e l'indice di un archivio, riportandolo vuoto.
+
+ \param db archivio degli utenti
+*/
+void freeUserDb(userdb_t* db);
+
+/** Cambia lo stato di un utente a partire dal suo nodo, inserendolo o rimuovendolo
+    dalla lobby se lo stato \c WAITING viene acquisito o perso (in tempo logaritmico nel
+    numero di utenti in attesa); in tal caso incrementa la versione della lobby, per cui chi
+    conserva una copia della lista degli utenti in attesa puo' riconoscere se e' ancora valida.
+
+ \param db archivio degli utenti
+ \param h nodo dell'utente
+ \param st stato da settare
+*/
+void changeStatus(userdb_t* db, nodo_t* h, status_t st);
+
+/** Setta lo stato di un utente (se esiste) aggiornando la lobby.
+ \param db archivio degli utenti
+ \param u  utente da cercare
+ \param st stato da settare 
+
+ \retval TRUE se l'utente e' presente
+ \retval FALSE se non e' presente
+*/
+bool_t setUserStatusDb(userdb_t* db, char* u, status_t st);
+
+/** Rimuove un utente dall'archivio (se e' presente e la password coincide),
+    togliendolo dall'indice hash e dalla lobby se vi si trova. Il nodo viene riciclato
+    solo al termine del periodo di grazia (\c epochRetire), per cui i lettori senza lock
+    che lo stanno esaminando possono proseguire.
+
+\param db archivio degli utenti
+\param puser puntatore utente da rimuovere
+
+\retval NOUSR se l'utente non e' presente
+\retval WRPWD se la password e' errata
+\retval 0 se la rimozione e' avvenuta correttamente
+\retval -1 se si e' verificato un errore (setta \c errno)
+*/
+int removeUserDb(userdb_t* db, user_t* puser);
+
+/** Fornisce la lista degli utenti in attesa a partire dalla lobby, in tempo
+    proporzionale al numero di utenti in attesa (l'ordine e' lo stesso di
+    <tt>getUserList(db->root, WAITING)</tt>).
+
+\param db archivio degli utenti
+
+\retval s la stringa con gli utenti secondo il formato user1:user2:...:userN
+\retval NULL se non ci sono utenti in attesa (\c errno == 0) o se si e' verificato
+un errore (\c errno != 0)
+*/
+char* getLobbyList(userdb_t* db);
+
+/** Come \c getLobbyList, ma scrive la lista in un buffer riusabile fornito dal chiamante
+    (con la stessa convenzione di \c getUserListBuf).
+
+\param db archivio degli utenti
+\param buf puntatore al buffer (allocato con \c malloc, oppure \c NULL)
+\param size puntatore alla dimensione del buffer (0 se \c *buf == \c NULL)
+
+\retval n la lunghezza della lista in \c *buf (0 se non ci sono utenti in attesa)
+\retval -1 se si e' verificato un errore (setta \c errno)
+*/
+int getLobbyListBuf(userdb_t* db, char** buf, size_t* size);
+
+/** Fornisce una pagina della lista degli utenti in attesa: a partire dal primo utente il cui
+    nome inizia con \c prefix, saltati i primi \c offset, gli utenti successivi (al piu' \c limit)
+    il cui nome inizia con \c prefix, nel formato user1:user2:...:userN. La pagina e' scritta
+    in un buffer riusabile fornito dal chiamante (con la stessa convenzione di \c getUserListBuf).
+    La posizione del primo utente della pagina e' calcolata sull'albero della lobby in tempo
+    logaritmico, per cui il costo dipende dalla dimensione della pagina e non da quella della lobby.
+
+\param db archivio degli utenti
+\param prefix prefisso degli username (\c NULL o stringa vuota per tutti gli utenti in attesa)
+\param offset numero di utenti da saltare
+\param limit numero massimo di utenti nella pagina
+\param buf puntatore al buffer (allocato con \c malloc, oppure \c NULL)
+\param size puntatore alla dimensione del buffer (0 se \c *buf == \c NULL)
+
+\retval n la lunghezza della pagina in \c *buf (0 se la pagina e' vuota)
+\retval -1 se si e' verificato un errore (setta \c errno)
+*/
+int getLobbyPage(userdb_t* db, char* prefix, unsigned int offset, unsigned int limit, char** buf, size_t* size);
+
+/** Connessione di un utente in un'unica operazione sul nodo: controlla la password,
+    controlla che l'utente non sia gia' connesso (stato \c DISCONNECTED e canale -1) e
+    setta stato e canale.
+
+ \param db archivio degli utenti
+ \param h nodo dell'utente (restituito da \c findUser, eventualmente \c NULL)
+ \param puser utente di cui controllare la password
+ \param st stato da settare
+ \param ch canale da settare
+
+ \retval 0 se l'utente e' stato connesso
+ \retval NOUSR se \c h == \c NULL
+ \retval WRPWD se la password e' errata
+ \retval ALRCONN se l'utente e' gia' connesso
+*/
+int connectUser(userdb_t* db, nodo_t* h, user_t* puser, status_t st, int ch);
+
+/** Sfida di un utente in attesa: se l'utente e' nello stato \c WAITING viene portato
+    nello stato \c PLAYING e ne viene restituito il canale.
+
+ \param db archivio degli utenti
+ \param u utente da sfidare
+ \param h puntatore in cui viene memorizzato il nodo dell'utente sfidato
+
+ \retval ch canale dell'utente sfidato
+ \retval NOUSR se l'utente non e' presente o non e' in attesa
+*/
+int claimUser(userdb_t* db, char* u, nodo_t** h);
+
+/** Setta stato e canale di un utente a partire dal suo nodo.
+
+ \param db archivio degli utenti
+ \param h nodo dell'utente
+ \param st stato da settare
+ \param ch canale da settare
+*/
+void updateUser(userdb_t* db, nodo_t* h, status_t st, int ch);
+
+/** Disconnessione di un utente a partire dal suo nodo (stato \c DISCONNECTED, canale -1),
+    eseguita solo se l'utente e' ancora connesso sul canale \c ch (cioe' se nel frattempo
+    non e' stato disconnesso e riconnesso su un altro canale).
+
+ \param db archivio degli utenti
+ \param h nodo dell'utente
+ \param ch canale della sessione da chiudere
+*/
+void releaseUser(userdb_t* db, nodo_t* h, int ch);
 #endif